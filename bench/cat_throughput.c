@@ -0,0 +1,165 @@
+// Throughput of the cat builtin's copy_fd against the old 4 KiB
+// read/write loop, for the fd pairs cat meets in pipelines.
+//
+// usage: cat_throughput [size_mb] [tmp_dir]
+// Prints one JSON object per line.
+
+#define _GNU_SOURCE
+
+#include "../headers/fastcopy.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+typedef int (*copy_impl)(int in_fd, int out_fd);
+
+// The cat builtin before copy_fd
+static int legacy_copy(int in_fd, int out_fd) {
+    char buffer[BUFFER_SIZE];
+    ssize_t bytesRead;
+    while ((bytesRead = read(in_fd, buffer, sizeof(buffer))) > 0) {
+        if (write(out_fd, buffer, bytesRead) == -1)
+            return -1;
+    }
+    return bytesRead < 0 ? -1 : 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_source(const char* path, size_t bytes) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(path); exit(1); }
+
+    char block[1 << 16];
+    for (size_t i = 0; i < sizeof(block); ++i)
+        block[i] = (char)(i * 131 + 7);
+
+    for (size_t done = 0; done < bytes; done += sizeof(block)) {
+        if (write(fd, block, sizeof(block)) != (ssize_t)sizeof(block)) {
+            perror("write");
+            exit(1);
+        }
+    }
+    fsync(fd);
+    close(fd);
+}
+
+// Child that empties a pipe into /dev/null, identical for both impls
+static pid_t start_drain(int read_fd, int write_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(write_fd);
+        int null_fd = open("/dev/null", O_WRONLY);
+        while (splice(read_fd, NULL, null_fd, NULL, 1 << 20, SPLICE_F_MOVE) > 0)
+            ;
+        _exit(0);
+    }
+    return pid;
+}
+
+// Child that fills a pipe from the source file, identical for both impls
+static pid_t start_feed(const char* src, int read_fd, int write_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(read_fd);
+        int fd = open(src, O_RDONLY);
+        while (splice(fd, NULL, write_fd, NULL, 1 << 20, SPLICE_F_MOVE) > 0)
+            ;
+        _exit(0);
+    }
+    return pid;
+}
+
+static double file_to_file(copy_impl copy, const char* src, const char* dst) {
+    int in = open(src, O_RDONLY);
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    double start = now_seconds();
+    copy(in, out);
+    double elapsed = now_seconds() - start;
+
+    close(in);
+    close(out);
+    return elapsed;
+}
+
+static double file_to_pipe(copy_impl copy, const char* src, const char* dst) {
+    (void)dst;
+    int fds[2];
+    if (pipe(fds) < 0) { perror("pipe"); exit(1); }
+
+    pid_t drain = start_drain(fds[0], fds[1]);
+    close(fds[0]);
+
+    int in = open(src, O_RDONLY);
+    double start = now_seconds();
+    copy(in, fds[1]);
+    close(fds[1]);
+    waitpid(drain, NULL, 0);
+    double elapsed = now_seconds() - start;
+
+    close(in);
+    return elapsed;
+}
+
+static double pipe_to_file(copy_impl copy, const char* src, const char* dst) {
+    int fds[2];
+    if (pipe(fds) < 0) { perror("pipe"); exit(1); }
+
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    double start = now_seconds();
+    pid_t feed = start_feed(src, fds[0], fds[1]);
+    close(fds[1]);
+    copy(fds[0], out);
+    waitpid(feed, NULL, 0);
+    double elapsed = now_seconds() - start;
+
+    close(fds[0]);
+    close(out);
+    return elapsed;
+}
+
+typedef struct {
+    const char* name;
+    double (*run)(copy_impl, const char*, const char*);
+} scenario;
+
+int main(int argc, char** argv) {
+    size_t size_mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 512;
+    const char* dir = (argc > 2) ? argv[2] : "/tmp";
+
+    char src[PATH_MAX], dst[PATH_MAX];
+    snprintf(src, sizeof(src), "%s/cat_bench_src.%d", dir, (int)getpid());
+    snprintf(dst, sizeof(dst), "%s/cat_bench_dst.%d", dir, (int)getpid());
+
+    make_source(src, size_mb << 20);
+
+    scenario scenarios[] = {
+        {"file_to_file", file_to_file},
+        {"file_to_pipe", file_to_pipe},
+        {"pipe_to_file", pipe_to_file},
+    };
+    struct { const char* name; copy_impl fn; } impls[] = {
+        {"legacy_4k", legacy_copy},
+        {"copy_fd", copy_fd},
+    };
+
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s) {
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+            double secs = scenarios[s].run(impls[i].fn, src, dst);
+            printf("{\"bench\":\"cat_throughput\",\"scenario\":\"%s\",\"impl\":\"%s\","
+                   "\"bytes\":%zu,\"seconds\":%.6f,\"mib_per_s\":%.1f}\n",
+                   scenarios[s].name, impls[i].name, size_mb << 20, secs, size_mb / secs);
+        }
+    }
+
+    unlink(src);
+    unlink(dst);
+    return 0;
+}
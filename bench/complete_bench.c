@@ -0,0 +1,79 @@
+// Tab completion against a PATH directory holding many executables:
+// the first (indexing) completion, then command and filename lookups.
+//
+// usage: complete_bench [executables] [lookups]
+// Prints one JSON object per line.
+
+#include "../headers/complete.h"
+#include "../headers/variables.h"
+
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, size_t files, size_t ops, double secs) {
+    printf("{\"bench\":\"complete\",\"case\":\"%s\",\"executables\":%zu,\"ops\":%zu,"
+           "\"seconds\":%.6f,\"us_per_op\":%.2f}\n",
+           name, files, ops, secs, secs * 1e6 / ops);
+}
+
+int main(int argc, char** argv) {
+    size_t files = (argc > 1) ? strtoul(argv[1], NULL, 10) : 30000;
+    size_t lookups = (argc > 2) ? strtoul(argv[2], NULL, 10) : 20000;
+
+    char dir[] = "/tmp/complete_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    for (size_t i = 0; i < files; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/cmd%05zu_%c", dir, i, 'a' + (int)(i % 26));
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0755);
+        if (fd < 0) {
+            perror("open");
+            return 1;
+        }
+        close(fd);
+    }
+    set_var("PATH", dir);
+
+    completion c;
+    double start = now_seconds();
+    complete_command("cmd1", &c);
+    report("command_first", files, 1, now_seconds() - start);
+
+    // a short prefix matching thousands, then ones narrowing to a few
+    static const char* prefixes[] = { "cmd1", "cmd12", "cmd123", "cmd2999", "ec", "zz" };
+    size_t found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; ++i) {
+        complete_command(prefixes[i % 6], &c);
+        found += c.count;
+    }
+    report("command", files, lookups, now_seconds() - start);
+
+    char word[PATH_MAX];
+    snprintf(word, sizeof(word), "%s/cmd2", dir);
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; ++i) {
+        complete_filename(word, &c);
+        found += c.count;
+    }
+    report("filename", files, lookups, now_seconds() - start);
+
+    for (size_t i = 0; i < files; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/cmd%05zu_%c", dir, i, 'a' + (int)(i % 26));
+        unlink(path);
+    }
+    rmdir(dir);
+
+    if (found == 0)
+        fprintf(stderr, "complete_bench: no completions found\n");
+    return 0;
+}
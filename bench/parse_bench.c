@@ -0,0 +1,95 @@
+// Parser throughput on generated long command lines, each parsed and
+// then expanded the way the executor does right before running it.
+//
+// usage: parse_bench [lines] [words_per_stage]
+// Prints one JSON object per line.
+
+#include "../headers/parser.h"
+#include "../headers/variables.h"
+
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A script-like line: several pipeline stages of plain, quoted and
+// $VAR words, with a redirection at the end.
+static char* make_line(size_t words_per_stage, unsigned seed) {
+    size_t cap = words_per_stage * 4 * 32 + 64;
+    char* line = malloc(cap);
+    size_t len = 0;
+
+    for (int stage = 0; stage < 4; ++stage) {
+        if (stage > 0) len += sprintf(line + len, " | ");
+        len += sprintf(line + len, "command%d", stage);
+
+        for (size_t w = 0; w < words_per_stage; ++w) {
+            seed = seed * 1103515245u + 12345u;
+            switch ((seed >> 16) % 5) {
+                case 0: len += sprintf(line + len, " --option-%zu=value", w); break;
+                case 1: len += sprintf(line + len, " \"quoted arg %zu\"", w); break;
+                case 2: len += sprintf(line + len, " '$literal%zu'", w); break;
+                case 3: len += sprintf(line + len, " $BENCH_VAR/path%zu", w); break;
+                default: len += sprintf(line + len, " /usr/share/some/long/file/name_%zu.txt", w); break;
+            }
+        }
+    }
+    sprintf(line + len, " > /tmp/parse_bench.out");
+    return line;
+}
+
+static void run(const char* name, size_t lines, size_t words_per_stage) {
+    enum { DISTINCT = 64 };
+    char* inputs[DISTINCT];
+    size_t bytes = 0;
+    for (int i = 0; i < DISTINCT; ++i)
+        inputs[i] = make_line(words_per_stage, i + 1);
+    for (size_t i = 0; i < lines; ++i)
+        bytes += strlen(inputs[i % DISTINCT]);
+
+    arena a = {0};
+    size_t commands = 0;
+
+    double start = now_seconds();
+    for (size_t i = 0; i < lines; ++i) {
+        node* n = parse_input(&a, inputs[i % DISTINCT]);
+        if (n == NULL) {
+            fprintf(stderr, "parse failed: %s\n", inputs[i % DISTINCT]);
+            exit(1);
+        }
+        pipeline* p = n->pipeline;
+        for (size_t c = 0; c < p->cmdc; ++c)
+            expand_command(&a, p->cmds[c]);
+        commands += p->cmdc;
+        arena_reset(&a);
+    }
+    double secs = now_seconds() - start;
+
+    printf("{\"bench\":\"parse\",\"case\":\"%s\",\"lines\":%zu,\"bytes\":%zu,\"commands\":%zu,"
+           "\"seconds\":%.6f,\"lines_per_s\":%.0f,\"mib_per_s\":%.1f}\n",
+           name, lines, bytes, commands, secs, lines / secs, bytes / secs / (1 << 20));
+
+    for (int i = 0; i < DISTINCT; ++i)
+        free(inputs[i]);
+    arena_free(&a);
+}
+
+int main(int argc, char** argv) {
+    size_t lines = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+    size_t words = (argc > 2) ? strtoul(argv[2], NULL, 10) : 0;
+
+    set_var("BENCH_VAR", "/home/bench");
+
+    if (words) {
+        run("custom", lines, words);
+        return 0;
+    }
+
+    run("short", lines, 2);
+    run("medium", lines / 4, 16);
+    run("long", lines / 40, 256);
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Stage-to-stage pipe throughput at different pipe capacities: a child
+// writes a fixed amount in write-size chunks, the parent reads it with a
+// buffer as large as the pipe. Context switches are counted for both.
+//
+// usage: pipe_bench [MiB per case]
+// Prints one JSON object per line.
+
+#define _GNU_SOURCE
+#include "../headers/headers.h"
+
+#include <time.h>
+#include <sys/resource.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long switches(int who) {
+    struct rusage ru;
+    getrusage(who, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void run_case(size_t capacity, size_t write_size, int packet, size_t total) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | (packet ? O_DIRECT : 0)) < 0) {
+        perror("pipe2");
+        exit(1);
+    }
+    int actual = fcntl(fds[1], F_SETPIPE_SZ, (int)capacity);
+    if (actual < 0) {
+        perror("F_SETPIPE_SZ");
+        exit(1);
+    }
+
+    long before_self = switches(RUSAGE_SELF);
+    long before_children = switches(RUSAGE_CHILDREN);
+    double start = now_seconds();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        char* buf = calloc(1, write_size);
+        for (size_t done = 0; done < total; done += write_size)
+            if (write(fds[1], buf, write_size) < 0) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    char* buf = malloc(actual);
+    size_t got = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf, actual)) > 0)
+        got += n;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    free(buf);
+
+    double secs = now_seconds() - start;
+    long csw = switches(RUSAGE_SELF) - before_self + switches(RUSAGE_CHILDREN) - before_children;
+    printf("{\"bench\":\"pipe\",\"capacity\":%d,\"write_size\":%zu,\"packet\":%d,\"bytes\":%zu,"
+           "\"seconds\":%.6f,\"mib_per_s\":%.1f,\"switches_per_mib\":%.1f}\n",
+           actual, write_size, packet, got, secs, got / secs / (1 << 20),
+           csw / ((double)got / (1 << 20)));
+}
+
+int main(int argc, char** argv) {
+    size_t mib = (argc > 1) ? strtoul(argv[1], NULL, 10) : 512;
+    size_t total = mib << 20;
+
+    static const size_t capacities[] = { 16 << 10, 64 << 10, 256 << 10, 1 << 20 };
+    // stdio-sized writes from a log producer, and bulk writes like cat's
+    static const size_t write_sizes[] = { 4 << 10, 128 << 10 };
+
+    for (size_t w = 0; w < 2; ++w)
+        for (size_t c = 0; c < 4; ++c)
+            run_case(capacities[c], write_sizes[w], 0, total);
+
+    // packet mode: every 4 KiB write is read back as its own packet
+    run_case(64 << 10, 4 << 10, 1, total);
+    run_case(1 << 20, 4 << 10, 1, total);
+    return 0;
+}
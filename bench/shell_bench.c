@@ -0,0 +1,293 @@
+// End-to-end hot paths of a shell binary, driven through generated
+// scripts: external and builtin command rate, pipeline setup, cat builtin
+// pipes, background job reaping, a counting loop that never leaves the shell
+// and starting a long script with and without its compiled form cached.
+//
+// usage: shell_bench <shell> [reps] [tmp_dir]
+// Prints one JSON object per line. Every case runs reps times (default 5)
+// after a warm-up run; the median and the best run are reported.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char** environ;
+
+static const char* shell_path;
+static const char* tmp_dir;
+static int reps;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FILE* open_script(char* path, size_t size) {
+    snprintf(path, size, "%s/shell_bench.%d.sh", tmp_dir, (int)getpid());
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    return f;
+}
+
+// Runs the shell on a script with its output discarded
+static double run_script(const char* script) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char* argv[] = { (char*)shell_path, (char*)script, NULL };
+    double start = now_seconds();
+
+    pid_t pid;
+    int err = posix_spawn(&pid, shell_path, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", shell_path, strerror(err));
+        exit(1);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    double secs = now_seconds() - start;
+
+    if (!WIFEXITED(status)) {
+        fprintf(stderr, "shell_bench: %s died running %s\n", shell_path, script);
+        exit(1);
+    }
+    return secs;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Warm-up, then reps timed runs; fills median and best
+static void measure(const char* script, double* median, double* best) {
+    double times[reps];
+    run_script(script);
+    for (int i = 0; i < reps; ++i)
+        times[i] = run_script(script);
+    qsort(times, reps, sizeof(double), compare_doubles);
+    *median = times[reps / 2];
+    *best = times[0];
+}
+
+static void report(const char* name, const char* param, size_t ops, const char* unit,
+                   double median, double best) {
+    printf("{\"bench\":\"shell\",\"case\":\"%s\"%s%s,\"ops\":%zu,\"median_s\":%.6f,\"best_s\":%.6f,"
+           "\"%s\":%.1f}\n",
+           name, param ? "," : "", param ? param : "", ops, median, best, unit,
+           strcmp(unit, "us_per_op") == 0 ? median * 1e6 / ops : ops / median);
+    fflush(stdout);
+}
+
+// One simple command per line; /bin/true keeps the case on fork and exec
+// now that plain true is a builtin answered without leaving the shell.
+static void bench_command(const char* name, const char* line) {
+    enum { LINES = 2000 };
+    char script[PATH_MAX];
+    FILE* f = open_script(script, sizeof(script));
+    for (int i = 0; i < LINES; ++i)
+        fprintf(f, "%s\n", line);
+    fclose(f);
+
+    double median, best;
+    measure(script, &median, &best);
+    report(name, NULL, LINES, "ops_per_s", median, best);
+    unlink(script);
+}
+
+static void bench_pipeline_setup(void) {
+    enum { LINES = 300 };
+    static const int stages[] = { 2, 4, 8, 16 };
+
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); ++s) {
+        char script[PATH_MAX];
+        FILE* f = open_script(script, sizeof(script));
+        for (int i = 0; i < LINES; ++i) {
+            for (int k = 0; k < stages[s]; ++k)
+                fputs(k ? " | /bin/true" : "/bin/true", f);
+            fputc('\n', f);
+        }
+        fclose(f);
+
+        char param[32];
+        snprintf(param, sizeof(param), "\"stages\":%d", stages[s]);
+
+        double median, best;
+        measure(script, &median, &best);
+        report("pipeline_setup", param, LINES, "us_per_op", median, best);
+        unlink(script);
+    }
+}
+
+static void bench_cat_pipe(void) {
+    enum { SIZE_MB = 256 };
+    char data[PATH_MAX];
+    snprintf(data, sizeof(data), "%s/shell_bench_data.%d", tmp_dir, (int)getpid());
+
+    int fd = open(data, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(data);
+        exit(1);
+    }
+    char block[1 << 16];
+    for (size_t i = 0; i < sizeof(block); ++i)
+        block[i] = (char)(i * 131 + 7);
+    for (int i = 0; i < SIZE_MB * 16; ++i) {
+        if (write(fd, block, sizeof(block)) != sizeof(block)) {
+            perror("write");
+            exit(1);
+        }
+    }
+    close(fd);
+
+    char script[PATH_MAX];
+    FILE* f = open_script(script, sizeof(script));
+    fprintf(f, "cat %s | cat | cat > /dev/null\n", data);
+    fclose(f);
+
+    double median, best;
+    measure(script, &median, &best);
+    printf("{\"bench\":\"shell\",\"case\":\"cat_pipe\",\"stages\":3,\"bytes\":%zu,\"median_s\":%.6f,"
+           "\"best_s\":%.6f,\"mib_per_s\":%.1f}\n",
+           (size_t)SIZE_MB << 20, median, best, SIZE_MB / median);
+    fflush(stdout);
+
+    unlink(script);
+    unlink(data);
+}
+
+static void bench_job_reaping(void) {
+    enum { JOBS = 3000 };
+    char script[PATH_MAX];
+    FILE* f = open_script(script, sizeof(script));
+    for (int i = 0; i < JOBS; ++i)
+        fputs("true &\n", f);
+    fputs("jobs\n", f);
+    fclose(f);
+
+    double median, best;
+    measure(script, &median, &best);
+    report("background_jobs", NULL, JOBS, "ops_per_s", median, best);
+    unlink(script);
+}
+
+static void bench_script_loop(void) {
+    enum { ITERATIONS = 200000 };
+    char script[PATH_MAX];
+    FILE* f = open_script(script, sizeof(script));
+    fprintf(f, "set i=0\nwhile [ $i -lt %d ]; do set i=$((i + 1)); done\n", ITERATIONS);
+    fclose(f);
+
+    double median, best;
+    measure(script, &median, &best);
+    report("script_loop", NULL, ITERATIONS, "us_per_op", median, best);
+    unlink(script);
+}
+
+static void remove_tree(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir) {
+        struct dirent* e;
+        while ((e = readdir(dir)) != NULL) {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+            char child[PATH_MAX];
+            snprintf(child, sizeof(child), "%s/%s", path, e->d_name);
+            remove_tree(child);
+        }
+        closedir(dir);
+    }
+    remove(path);
+}
+
+// Lines that take parsing but next to no running
+static void bench_script_cache(void) {
+    enum { LINES = 5000 };
+    char cache[PATH_MAX];
+    snprintf(cache, sizeof(cache), "%s/shell_bench_cache.%d", tmp_dir, (int)getpid());
+    setenv("XDG_CACHE_HOME", cache, 1);
+
+    char script[PATH_MAX];
+    FILE* f = open_script(script, sizeof(script));
+    for (int i = 0; i < LINES; ++i)
+        fprintf(f, "false && echo \"$HOME/%d\" | cat > /dev/null; "
+                   "if false; then for x in a b c; do echo $x; done; fi\n", i);
+    fclose(f);
+
+    double median, best;
+    setenv("SHELL_NO_CACHE", "1", 1);
+    measure(script, &median, &best);
+    report("script_startup", "\"cache\":\"off\"", LINES, "us_per_op", median, best);
+
+    // the warm-up run compiles it
+    unsetenv("SHELL_NO_CACHE");
+    measure(script, &median, &best);
+    report("script_startup", "\"cache\":\"on\"", LINES, "us_per_op", median, best);
+
+    unlink(script);
+    remove_tree(cache);
+    unsetenv("XDG_CACHE_HOME");
+}
+
+// The same line over and over against lines that all differ: the parse
+// cache serves the first, the second parses every line
+static void bench_repeated_lines(void) {
+    enum { LINES = 5000 };
+    static const char* const kinds[] = { "distinct", "repeated" };
+    setenv("SHELL_NO_CACHE", "1", 1);
+
+    for (int k = 0; k < 2; ++k) {
+        char script[PATH_MAX];
+        FILE* f = open_script(script, sizeof(script));
+        for (int i = 0; i < LINES; ++i)
+            fprintf(f, "false && echo \"$HOME/%d\" | cat > /dev/null; "
+                       "if false; then for x in a b c; do echo $x; done; fi\n", k ? 0 : i);
+        fclose(f);
+
+        char param[32];
+        snprintf(param, sizeof(param), "\"lines\":\"%s\"", kinds[k]);
+        double median, best;
+        measure(script, &median, &best);
+        report("parse_cache", param, LINES, "us_per_op", median, best);
+        unlink(script);
+    }
+    unsetenv("SHELL_NO_CACHE");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: shell_bench <shell> [reps] [tmp_dir]\n");
+        return 2;
+    }
+    shell_path = argv[1];
+    reps = (argc > 2) ? atoi(argv[2]) : 5;
+    tmp_dir = (argc > 3) ? argv[3] : "/tmp";
+    if (reps < 1) reps = 1;
+
+    bench_command("true", "/bin/true");
+    bench_command("true_builtin", "true");
+    bench_pipeline_setup();
+    bench_cat_pipe();
+    bench_job_reaping();
+    bench_script_loop();
+    bench_script_cache();
+    bench_repeated_lines();
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Variable store with a large environment: import at startup, lookups
+// (hits and misses) and updates of exported variables.
+//
+// usage: var_bench [variables] [lookups]
+// Prints one JSON object per line.
+
+#include "../headers/variables.h"
+
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, size_t vars, size_t ops, double secs) {
+    printf("{\"bench\":\"variables\",\"case\":\"%s\",\"variables\":%zu,\"ops\":%zu,"
+           "\"seconds\":%.6f,\"ns_per_op\":%.1f}\n",
+           name, vars, ops, secs, secs * 1e9 / ops);
+}
+
+int main(int argc, char** argv) {
+    size_t vars = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t lookups = (argc > 2) ? strtoul(argv[2], NULL, 10) : 5000000;
+
+    // A synthetic environment the size of a bloated CI job's
+    char** env = calloc(vars + 1, sizeof(char*));
+    char** names = calloc(vars, sizeof(char*));
+    for (size_t i = 0; i < vars; ++i) {
+        char entry[64];
+        snprintf(entry, sizeof(entry), "BENCH_VARIABLE_%zu=value_%zu", i, i);
+        env[i] = strdup(entry);
+        names[i] = strndup(entry, strchr(entry, '=') - entry);
+    }
+    environ = env;
+
+    double start = now_seconds();
+    load_environment();
+    report("load_environment", vars, vars, now_seconds() - start);
+
+    unsigned seed = 12345;
+    size_t found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        found += get_var(names[(seed >> 8) % vars]) != NULL;
+    }
+    report("lookup_hit", vars, lookups, now_seconds() - start);
+
+    static const char* missing[] = { "NOT_SET", "MISSING_VARIABLE", "X", "BENCH_VARIABLE_" };
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; ++i)
+        found += get_var(missing[i & 3]) != NULL;
+    report("lookup_miss", vars, lookups, now_seconds() - start);
+
+    size_t updates = lookups / 10;
+    start = now_seconds();
+    for (size_t i = 0; i < updates; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        set_var(names[(seed >> 8) % vars], "updated");
+    }
+    report("set_exported", vars, updates, now_seconds() - start);
+
+    if (found == 0 || var_environ()[0] == NULL)
+        fprintf(stderr, "var_bench: lookups found nothing\n");
+    return 0;
+}
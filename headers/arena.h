@@ -0,0 +1,42 @@
+#pragma once
+
+#include "headers.h"
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block;
+
+// Bump allocator for everything that lives exactly as long as one command
+// line. Resetting keeps the blocks, so a warmed-up arena never mallocs.
+typedef struct {
+    arena_block* head;
+    arena_block* current;
+    void* last;        // most recent allocation, the only one that can grow in place
+} arena;
+
+typedef struct {
+    arena_block* block;
+    size_t used;
+} arena_mark;
+
+void* arena_alloc(arena* a, size_t size);
+
+void* arena_grow(arena* a, void* ptr, size_t old_size, size_t new_size);
+
+char* arena_strdup(arena* a, const char* s);
+
+char* arena_strndup(arena* a, const char* s, size_t len);
+
+arena_mark arena_save(arena* a);
+
+void arena_restore(arena* a, arena_mark mark);
+
+void arena_reset(arena* a);
+
+void arena_free(arena* a);
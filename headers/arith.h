@@ -0,0 +1,16 @@
+#pragma once
+
+#include "headers.h"
+
+// Evaluates the text of a $(( )) expansion: 64-bit integers, the C
+// operators (plus **), and shell variables by name, unset ones reading as
+// 0. Assignments and ++/-- store back into the variables.
+// Returns -1, with the reason printed, if the expression is bad.
+int arith_eval(const char* expr, long long* result);
+
+// Room for any value as decimal text, sign and terminator included
+#define ARITH_TEXT_SIZE 21
+
+// Writes value in decimal into out, which holds ARITH_TEXT_SIZE bytes;
+// returns the length
+size_t arith_format(long long value, char* out);
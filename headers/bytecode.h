@@ -0,0 +1,65 @@
+#pragma once
+
+#include "headers.h"
+#include "arena.h"
+#include "pipelines.h"
+
+#include <sys/stat.h>
+
+// Scripts compiled to a flat, pointer-free form: one unit per line (or
+// group of lines) the batch reader would have parsed, each a tree written
+// out as opcodes. Builtins are stored resolved, words already split into
+// their parts and redirections as opcodes of their own.
+//
+// The compiled form is cached in $XDG_CACHE_HOME/shell (~/.cache/shell),
+// keyed by the script's path, mtime and size, and mapped on later runs so
+// nothing is lexed or parsed. SHELL_NO_CACHE turns the cache off.
+
+typedef struct {
+    unsigned char* bytes;
+    size_t len;
+    size_t cap;
+} bytecode_buffer;
+
+typedef struct {
+    bytecode_buffer code;
+    bytecode_buffer pool;   // every distinct string once, NUL-terminated
+    uint32_t* slots;        // open addressing: pool offset + 1, or 0
+    size_t slot_count;
+    size_t string_count;
+    uint32_t units;
+    int failed;      // something couldn't be recorded; nothing gets saved
+} bytecode_writer;
+
+typedef struct {
+    unsigned char* map;
+    size_t map_size;
+    char* pool;
+    size_t pool_len;
+    const unsigned char* pos;
+    const unsigned char* end;
+    uint32_t units_left;
+} bytecode_program;
+
+void bytecode_writer_init(bytecode_writer* w);
+
+// Records the next unit: the parsed tree and the text it came from
+void bytecode_add(bytecode_writer* w, const node* tree, const char* text);
+
+// Writes the recorded units as the cache entry for the script at path,
+// whose stat st was taken before it was read. Returns -1 if it couldn't.
+int bytecode_save(bytecode_writer* w, const char* path, const struct stat* st);
+
+void bytecode_writer_free(bytecode_writer* w);
+
+// Maps the cache entry for the script, if there is an up-to-date one.
+// Returns -1 when the script has to be parsed instead.
+int bytecode_open(bytecode_program* prog, const char* path, const struct stat* st);
+
+// The next unit's tree, allocated in a, and its text. NULL if it can't be
+// decoded.
+node* bytecode_next(bytecode_program* prog, arena* a, const char** text);
+
+int bytecode_at_end(const bytecode_program* prog);
+
+void bytecode_close(bytecode_program* prog);
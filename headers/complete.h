@@ -0,0 +1,22 @@
+#pragma once
+
+#include "headers.h"
+
+#include <sys/stat.h>
+
+#define COMPLETE_DIR_CACHE 8        // directories kept for filename completion
+#define COMPLETE_LIST_MAX 200       // candidates shown when a Tab lists them
+
+// Candidates for the word being completed, sorted. Directory names carry
+// a trailing '/'. Valid until the next completion call.
+typedef struct {
+    const char** matches;
+    size_t count;
+    size_t base_len;    // how much of the word the matches already start with
+} completion;
+
+// Commands: PATH executables and builtins
+void complete_command(const char* word, completion* out);
+
+// Files, for words with a directory part or after the command
+void complete_filename(const char* word, completion* out);
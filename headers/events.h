@@ -0,0 +1,26 @@
+#pragma once
+
+#include "headers.h"
+#include "proc.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define EVENTS_BATCH 64
+
+int events_init(int watch_input);
+
+int events_reinit_in_child(void);
+
+const sigset_t* events_child_sigmask(void);
+
+// pidfd_open(2); -1 with errno ENOSYS where the kernel or libc lacks it
+int open_pidfd(pid_t pid);
+
+void events_watch_child(pid_t pid);
+
+int events_dispatch(int timeout_ms);
+
+int events_wait_for_input(void);
+
+void wait_for_job(job_t* job);
@@ -2,9 +2,35 @@
 
 #include "headers.h"
 #include "pipelines.h"
+#include "arena.h"
+
+// $? of the last pipeline, and whether the exit builtin has run
+extern int last_status;
+extern int exit_requested;
+
+// Loops being run, and a break/continue on its way out: the number of
+// loops it still has to leave, and whether the last one resumes
+extern int loop_depth;
+extern int loop_levels;
+extern int loop_continue;
+
+int redirect_fds(command* cmd);
 
 void duplicate_fd(command* cmd);
 
-void execute_pipeline(pipeline* curr_pipeline);
+// Both return the exit status of the pipeline's last stage (0 when it
+// goes to the background)
+int execute_pipeline(pipeline* curr_pipeline);
+
+int execute_single_command(pipeline* curr_pipeline);
+
+// Runs a parsed line, expanding each command's words in a as it comes up.
+// Stops early once exit_requested is set. Returns the last status.
+int execute_node(arena* a, node* n);
+
+// Runs the tree in a forked copy of the shell and waits for it
+int execute_subshell(arena* a, node* n);
 
-void execute_single_command(pipeline* curr_pipeline);
\ No newline at end of file
+// Marks the pipeline that runs last in the tree to exec in place of the
+// shell, for the final line of a script
+void mark_tail(node* n);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "headers.h"
+
+#define COPY_BUFFER_SIZE (128 * 1024)
+
+int copy_fd(int in_fd, int out_fd);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "headers.h"
+
+// FNV-1a, behind every hash table and cache key in the shell. Calls
+// chain: pass the previous result as h to hash more data after it.
+#define FNV1A_SEED 1469598103934665603ULL
+
+static inline uint64_t fnv1a(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Same, up to the terminating NUL
+static inline uint64_t fnv1a_str(uint64_t h, const char* s) {
+    for (const unsigned char* p = (const unsigned char*)s; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
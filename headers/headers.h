@@ -12,10 +12,7 @@
 #include <unistd.h>
 #include <termios.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-#define MAX_ARGS 100
-#define MAX_CMDS 100
-#define MAX_PROCESSES 100
-#define MAX_GLOBAL_PROCESSES 10000
 #define BUFFER_SIZE 4096
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "headers.h"
+
+#define HISTORY_MAX 1000            // entries kept in memory for Up/Down
+#define HISTORY_FILE ".shell_history"
+
+// Opens $HISTFILE (default ~/.shell_history): its tail fills the ring and
+// new lines are appended to it. The rest stays mmapped for searching.
+void history_init(void);
+
+// Records a line, unless it repeats the previous one
+void add_history(const char *cmd);
+
+int history_count(void);
+
+// i = 0 is the oldest entry in memory
+const char* history_get(int i);
+
+// Newest line containing needle that is older than *cursor (start with
+// -1 for "newest of all"). Moves *cursor to the match; NULL if none.
+const char* history_search(const char* needle, long* cursor);
@@ -2,19 +2,35 @@
 
 #include "headers.h"
 #include "internalfuncs.h"
+#include "history.h"
 
 #define ARROW_UP    1000
 #define ARROW_DOWN  1001
 #define ARROW_RIGHT 1002
 #define ARROW_LEFT  1003
 
-#define HISTORY_MAX 100
 #define INPUT_BUF 1024
+#define FRAME_BUF 4096
+#define READER_CHUNK (64 * 1024)
+#define READER_SHARED_CHUNK 4096
 
 static struct termios orig_termios;
 
-extern char *history[HISTORY_MAX];
-extern int history_len;
+// Streams lines out of a script, a -c string or a non-tty stdin without
+// going through the per-keystroke line editor.
+typedef struct {
+    int fd;          // source fd for chunked reads, -1 when data holds everything
+    char* data;      // mmapped file, copied string or read buffer
+    size_t len;
+    size_t pos;
+    size_t cap;
+    int mapped;
+    int shared;      // fd is the commands' stdin too, see reader_sync
+    int bytewise;    // shared but can't seek back: never read past a newline
+    char* line;      // NUL-terminated copy of the current line
+    size_t line_cap;
+} line_reader;
+
 extern int history_index;
 
 void disable_raw_mode();
@@ -23,8 +39,33 @@ void enable_raw_mode();
 
 int read_key();
 
-void add_history(const char *cmd);
+int input_pending(void);
+
+// The next prompt re-reads the working directory (after cd)
+void prompt_invalidate_cwd(void);
+
+// The next lines continue an unfinished command: show "> " instead
+void prompt_set_continuation(int on);
 
 void redraw_prompt(const char *buf);
 
-void read_line(char *buf);
\ No newline at end of file
+void read_line(char *buf);
+
+int reader_open_file(line_reader* r, const char* path);
+
+void reader_open_fd(line_reader* r, int fd);
+
+// Like reader_open_fd, for the shell's stdin that the commands read as well
+void reader_open_stdin(line_reader* r, int fd);
+
+void reader_open_string(line_reader* r, const char* text);
+
+char* reader_next_line(line_reader* r);
+
+int reader_at_end(const line_reader* r);
+
+// Gives read-ahead back to a shared fd before a command runs, so it reads
+// from the end of the shell's line
+void reader_sync(line_reader* r);
+
+void reader_close(line_reader* r);
\ No newline at end of file
@@ -7,30 +7,41 @@
 #include "variables.h"
 #include "pipelines.h"
 
-typedef void(*internal_func)(const command*);
+typedef int(*internal_func)(const command*);   // returns the exit status
 
 typedef struct {
     char* name;
     internal_func fptr;
     int run_in_parent;
+    int needs_own_process;  // never run inside the shell, even when it could
 } internal_pair;
 
-void internal_echo(const command*);
-void internal_pwd(const command*);
-void internal_cd(const command*);
-void internal_ls(const command*);
-void internal_cat(const command*);
-void internal_jobs(const command*);
-void internal_fg(const command*);
-void internal_bg(const command*);
-void internal_env(const command*);
-void internal_set(const command*);
-void internal_export(const command*);
-void internal_unset(const command*);
+int internal_echo(const command*);
+int internal_pwd(const command*);
+int internal_cd(const command*);
+int internal_ls(const command*);
+int internal_cat(const command*);
+int internal_jobs(const command*);
+int internal_fg(const command*);
+int internal_bg(const command*);
+int internal_env(const command*);
+int internal_set(const command*);
+int internal_export(const command*);
+int internal_unset(const command*);
+int internal_hash(const command*);
+int internal_exec(const command*);
+int internal_exit(const command*);
+int internal_test(const command*);
+int internal_true(const command*);
+int internal_false(const command*);
+int internal_break(const command*);
+int internal_continue(const command*);
+int internal_parallel(const command*);
+int internal_shellstats(const command*);
 
 static internal_pair internals[] = {
     {"echo", internal_echo, 0},
-    {"pwd", internal_pwd, 1},    // can run in child  
+    {"pwd", internal_pwd, 0},    // can run in child  
     {"cd", internal_cd, 1},      // MUST run in parent
     {"ls", internal_ls, 0},
     {"cat", internal_cat, 0},
@@ -41,9 +52,29 @@ static internal_pair internals[] = {
     {"set", internal_set, 1},
     {"unset", internal_unset, 1},
     {"export", internal_export, 1},
+    {"hash", internal_hash, 1},
+    {"exec", internal_exec, 1},
+    {"exit", internal_exit, 1},
+    {"test", internal_test, 0},
+    {"[", internal_test, 0},
+    {"true", internal_true, 0},
+    {"false", internal_false, 0},
+    {"break", internal_break, 1},
+    {"continue", internal_continue, 1},
+    {"parallel", internal_parallel, 0, 1},  // reaps its own workers
+    {"shellstats", internal_shellstats, 0},
     {NULL, NULL, 0}
 };
 
+// The internals[] index of name, or BUILTIN_NONE
+int resolve_builtin(const char* name);
+
+// The builtin cmd runs: the parser's answer when the name was literal,
+// otherwise a lookup of the expanded argv[0]. NULL for anything else.
+const internal_pair* command_builtin(const command* cmd);
+
 internal_func get_internal_func(char* cmd);
 
 int is_parent_builtin(char* cmd);
+
+int needs_own_process(char* cmd);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "headers.h"
+#include "arena.h"
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,          // |
+    TOK_REDIR_IN,      // <
+    TOK_REDIR_OUT,     // >
+    TOK_REDIR_APPEND,  // >>
+    TOK_BACKGROUND,    // &
+    TOK_AND,           // &&
+    TOK_OR,            // ||
+    TOK_SEMI,          // ;
+    TOK_DSEMI,         // ;; ends a case item
+    TOK_NEWLINE,       // separates commands like ;
+    TOK_LPAREN,        // (
+    TOK_RPAREN,        // )
+    TOK_END,
+    TOK_ERROR
+} token_type;
+
+#define PART_LITERAL 0
+#define PART_VAR     1
+#define PART_COMMAND 2
+#define PART_ARITH   3
+
+// One piece of a word: literal text (quotes and escapes already removed),
+// the name of a variable to substitute, a command whose output replaces it
+// or an arithmetic expression whose value does.
+typedef struct word_part {
+    int type;
+    char* text;
+    size_t len;
+    struct word_part* next;
+} word_part;
+
+typedef struct {
+    word_part* parts;
+    char* literal;   // the whole word when nothing in it needs expanding
+    int quoted;      // some part of the word was quoted or escaped
+} word;
+
+typedef struct {
+    token_type type;
+    word w;          // only for TOK_WORD
+    const char* start;  // where the token begins in the line
+} token;
+
+typedef struct {
+    arena* a;
+    const char* pos;
+    char* out;       // unescaped text of every word on the line goes here
+    const char* error;
+    int incomplete;  // the error is input that ended too early
+} lexer;
+
+void lexer_init(lexer* lx, arena* a, const char* line);
+
+token_type lexer_next(lexer* lx, token* tok);
+
+const char* token_name(token_type type);
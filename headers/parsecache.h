@@ -0,0 +1,23 @@
+#pragma once
+
+#include "headers.h"
+#include "pipelines.h"
+
+// Parsed lines kept across runs, keyed by their text: a line typed again
+// (history recall, a monitoring one-liner) or read again goes straight to
+// execution. Words are stored unexpanded, so a reused tree only redoes
+// the $VAR, $(...) and $(( )) parts as it runs; literal words cost nothing.
+//
+// Trees are only ever run, never changed, apart from the argv and
+// redirections expand_command fills in before each run, as for a loop
+// body. A tree to be marked with mark_tail must not come from here.
+
+#define PARSE_CACHE_SIZE 32
+
+extern unsigned long parse_cache_hits;
+extern unsigned long parse_cache_misses;
+
+// The tree for text, parsed now or on an earlier call. NULL on a syntax
+// error, with parse_incomplete set as by parse_input; nothing is kept then.
+// The tree stays valid until PARSE_CACHE_SIZE other lines have been parsed.
+node* parsecache_parse(const char* text);
@@ -4,19 +4,23 @@
 
 #include "proc.h"
 #include "pipelines.h"
+#include "arena.h"
+#include "lexer.h"
 
 extern int shell_interactive;
 extern pid_t shell_pgid;
 extern int shell_tty;
 extern volatile sig_atomic_t fg_pgid;
-extern volatile sig_atomic_t child_status_changed;
+// Ctrl+C arrived while a line ran; loops and lists stop early
+extern volatile sig_atomic_t interrupted;
+extern int finished_jobs;
+// Set when parse_input failed only because the input ended too early
+extern int parse_incomplete;
 
 void give_terminal_to(pid_t pgid);
 
 void reclaim_terminal(void);
 
-void sigchld_handler(int sig);
-
 void sigint_handler(int sig);
 
 void sigtstp_handler(int sig);
@@ -27,10 +31,28 @@ void set_handler(int signo, void (*handler)(int));
 
 void install_all_shell_handlers(void);
 
+void handle_child_state(pid_t pid, int state);
+
+void handle_child_status(pid_t pid, int status, const struct rusage* usage);
+
+void report_finished_jobs(void);
+
 void check_child_status(void);
 
 void setup_child_signals_and_pgrp(pid_t pg_leader_pgid, int is_fg);
 
-command* parse_cmd(char* cmd_as_string, size_t max_args);
+command* parse_cmd(arena* a, lexer* lx, token* tok);
+
+// NULL on a syntax error (already reported, unless parse_incomplete is
+// set); blank input is an empty pipeline
+node* parse_input(arena* a, char* buffer);
+
+void report_incomplete(void);
+
+// A word with its variables, commands and arithmetic substituted,
+// allocated in a. NULL if an expansion failed.
+char* expand_word(arena* a, const word* w);
 
-pipeline* parse_input(char* buffer, size_t max_cmds);
\ No newline at end of file
+// Expands the command's words into argv and its redirection targets,
+// allocated in a. Returns -1 if an expansion failed.
+int expand_command(arena* a, command* cmd);
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "headers.h"
+
+#include <sys/stat.h>
+
+typedef struct path_entry {
+    char* name;
+    char* path;
+    unsigned long hits;
+    struct path_entry* next;
+} path_entry_t;
+
+extern unsigned long path_cache_hits;
+extern unsigned long path_cache_misses;
+
+const char* pathcache_lookup(const char* name);
+
+int pathcache_warm(const char* name);
+
+void pathcache_forget(const char* name);
+
+void pathcache_clear(void);
+
+void pathcache_print(void);
+
+void pathcache_print_stats(void);
@@ -1,34 +1,84 @@
 #pragma once
 
 #include "headers.h"
+#include "lexer.h"
+
+struct node;
+
+// command.builtin when the name isn't a builtin, and when it is only known
+// once expanded
+#define BUILTIN_NONE       -1
+#define BUILTIN_UNRESOLVED -2
 
 struct command_inter {
     size_t argc;
-    char* argv[MAX_ARGS];
+    char** argv; // NULL-terminated, argc entries
     char* redirectInput;
     char* redirectOutput;
     int appendOutput; // either 0 or 1
+    // As parsed; expand_command fills argv and the redirections from these
+    // right before the command runs
+    size_t wordc;
+    word* words;
+    word* inputWord;
+    word* outputWord;
+    struct node* body; // { list }, ( list ) or if/for/while/case in place of words
+    int subshell; // body runs in a process of its own
+    int builtin; // internals[] index of a literal command name, resolved once
 }; 
 typedef struct command_inter command;
 
 extern command command_default;
 
+// One pipeline of a parsed line. It, its commands, their argv vectors and
+// the token text all live in the arena passed to parse_input.
 struct pipeline_inter {
     size_t cmdc;
-    command* cmds[MAX_CMDS];
+    command** cmds;
     int background; // either 0 or 1
-    char* buffer;
-    
+    int exec_in_place; // last command of a script: exec instead of fork+wait
+    int timed; // prefixed with the 'time' keyword
+    char* buffer; // the pipeline as typed, for job listings
+    char* pipe_capacity; // PIPE_CAPACITY=... before the pipeline, overrides the variable
+    char* pipe_packet; // PIPE_PACKET=... likewise
 };
 typedef struct pipeline_inter pipeline;
 
 extern pipeline pipeline_default;
 
-static void free_pipeline_mem(pipeline* p) {
-    if (!p) return;
-    for (size_t i = 0; i < p->cmdc; i++) {
-        if (p->cmds[i]) free(p->cmds[i]); // argv/redirects point inside p->buffer
-    }
-    free(p->buffer);
-    free(p);
-}
+typedef enum {
+    NODE_PIPELINE,
+    NODE_AND,       // left && right
+    NODE_OR,        // left || right
+    NODE_SEQUENCE,  // left ; right
+    NODE_IF,        // if left; then right; else alternative; fi
+    NODE_WHILE,     // while left; do right; done
+    NODE_UNTIL,     // until left; do right; done
+    NODE_FOR,       // for name in words; do right; done
+    NODE_CASE,      // case words[0] in items; esac
+} node_type;
+
+// pattern | pattern ) body ;;
+typedef struct {
+    word* patterns;
+    size_t patternc;
+    struct node* body; // NULL for an empty item
+} case_item;
+
+// A parsed line is a tree of these, pipelines at the leaves. Compound
+// commands sit in a command's body so they can take redirections and be
+// pipeline stages like any other command.
+typedef struct node {
+    node_type type;
+    pipeline* pipeline; // NODE_PIPELINE
+    struct node* left;
+    struct node* right;
+    struct node* alternative; // else branch of an if, an elif being a nested if
+    int background; // an and/or list followed by '&' (pipelines use their own flag)
+    char* text; // the list as typed, when it runs in the background
+    char* name; // for: the loop variable
+    word* words; // for: the list (no 'in' means none); case: the subject
+    size_t wordc;
+    case_item* items; // case
+    size_t itemc;
+} node;
@@ -2,14 +2,25 @@
 
 #include "headers.h"
 
+#include <sys/resource.h>
+#include <time.h>
+
 #define JOB_RUNNING 0
 #define JOB_STOPPED 1
 #define JOB_DONE    2
 
+struct job;
+
 typedef struct {
     pid_t pid;
     pid_t pgid;
     int status;
+    struct job* job;
+    char* name;                 // argv[0], for per-stage reports
+    int exit_status;            // wait status once done
+    struct timespec started;    // CLOCK_MONOTONIC
+    struct timespec finished;
+    struct rusage usage;        // from wait4, once done
 } process;
 
 typedef struct job {
@@ -18,32 +29,50 @@ typedef struct job {
     char* command_line;
     int status;
     struct job* next;
-    process* process_list[MAX_PROCESSES];
+    struct job* prev;
+    process** process_list;
     int process_counter;
+    int process_capacity;
+    int state_counts[3]; // processes per JOB_* state
+    struct timespec started;
+    struct rusage usage; // sum over the processes reaped so far
 } job_t;
 
 extern job_t* job_list;
 extern int last_id;
 
-extern process* global_process_list[MAX_GLOBAL_PROCESSES];
-extern int global_process_counter;
-
 pid_t get_pgid_of_process(pid_t pid);
 
+process* find_process(pid_t pid);
+
+void forget_process(process* proc);
+
 struct pipeline;
 
 job_t* add_job(pid_t pgid, const char* command_line, struct pipeline* p);
 
+job_t* add_foreground_job(pid_t pgid, const char* command_line);
+
+void assign_job_id(job_t* job);
+
 job_t* find_job_by_id(int job_id);
 
 job_t* find_job_by_pgid(pid_t pgid);
 
-void add_process_to_job(pid_t pgid, pid_t pid);
+void add_process_to_job(pid_t pgid, pid_t pid, const char* name);
+
+void record_process_exit(process* proc, int status, const struct rusage* usage);
+
+int job_exit_status(job_t* job);
 
 void remove_job(int job_id);
 
+void delete_job(job_t* job);
+
 void update_job_status(job_t* job, pid_t proc_pid, int check_status);
 
+void update_process_status(process* proc, int new_status);
+
 void update_all_processes_in_job(job_t* job, int new_status);
 
 bool job_is_stopped(job_t* job);
@@ -56,4 +85,4 @@ job_t* get_most_recent_stopped_job();
 
 int count_processes_in_job(job_t* job);
 
-int all_processes_done(job_t* job);
\ No newline at end of file
+int all_processes_done(job_t* job);
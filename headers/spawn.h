@@ -0,0 +1,22 @@
+#pragma once
+
+#include "headers.h"
+#include "pipelines.h"
+#include "internalfuncs.h"
+
+#include <spawn.h>
+
+typedef struct {
+    pid_t pgid;               // process group to join, 0 to lead a new one
+    int in_fd;                // dup'ed onto stdin, -1 to inherit
+    int out_fd;               // dup'ed onto stdout, -1 to inherit
+    const int* close_fds;     // pipe ends a forked builtin must close; exec'd
+    size_t close_count;       // children lose them through O_CLOEXEC
+    const sigset_t* sigmask;  // signal mask the child starts with
+} spawn_attrs;
+
+pid_t spawn_external(command* cmd, const spawn_attrs* attrs);
+
+pid_t spawn_builtin(command* cmd, internal_func func, const spawn_attrs* attrs);
+
+int exec_command(command* cmd);
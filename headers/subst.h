@@ -0,0 +1,8 @@
+#pragma once
+
+#include "headers.h"
+#include "arena.h"
+
+// Runs a command line and returns what it wrote to stdout, without the
+// trailing newlines, allocated in a. NULL if the line doesn't parse.
+char* command_substitution(arena* a, const char* text);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "headers.h"
+
+// Open addressing with linear probing for the shell's in-memory indexes.
+// Entries are fixed-size structs stored in the table itself, and each one
+// starts with its uint64_t hash, a zero hash marking a free slot. Removal
+// shifts the rest of the probe run back, so there are no tombstones and
+// lookups never slow down as entries come and go.
+//
+// Where equal keys can't be told from their hashes, an equal function
+// compares an entry with the key; with none, the hash is the key (a pid,
+// say). Growing moves entries, so pointers to them only last until the
+// next table_insert.
+typedef struct {
+    char* slots;
+    size_t entry_size;
+    size_t capacity;    // a power of two, or 0 before the first insert
+    size_t count;
+    unsigned shift;     // 64 - log2(capacity)
+} hash_table;
+
+#define TABLE_INIT(entry_type) { NULL, sizeof(entry_type), 0, 0, 0 }
+
+typedef int (*table_equal)(const void* entry, const void* key);
+
+// The entry with this hash that equal accepts, or NULL
+void* table_find(const hash_table* t, uint64_t hash, table_equal equal, const void* key);
+
+// The entry found as by table_find, or else a new one, zeroed apart from
+// its hash. NULL if the table couldn't grow.
+void* table_insert(hash_table* t, uint64_t hash, table_equal equal, const void* key);
+
+void table_remove(hash_table* t, void* entry);
+
+// The entry after prev (NULL for the first), or NULL at the end
+void* table_next(const hash_table* t, void* prev);
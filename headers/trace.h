@@ -0,0 +1,42 @@
+#pragma once
+
+#include "headers.h"
+
+#include <time.h>
+
+// Phases of running a line whose latency is recorded
+typedef enum {
+    TRACE_LINE,         // a whole line, parse to prompt
+    TRACE_PARSE,
+    TRACE_PATH_LOOKUP,
+    TRACE_PIPE_SETUP,
+    TRACE_SPAWN,
+    TRACE_TERMINAL,     // give_terminal_to / reclaim_terminal
+    TRACE_WAIT,         // waiting for a foreground job
+    TRACE_BUILTIN,      // builtins run inside the shell
+    TRACE_PHASES
+} trace_phase;
+
+// Monotonic nanoseconds
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t timespec_ns(const struct timespec* ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// Records now - start_ns for phase; detail (may be NULL) goes to the trace only
+void trace_record(trace_phase phase, uint64_t start_ns, const char* detail);
+
+// A child's lifetime on the trace timeline, one row per pid
+void trace_process(pid_t pid, const char* name, uint64_t start_ns, uint64_t end_ns);
+
+// Opens, switches or closes the trace file to follow $SHELL_TRACE
+void trace_sync_output(void);
+
+void trace_print_stats(void);
+
+void trace_reset_stats(void);
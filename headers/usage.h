@@ -0,0 +1,34 @@
+#pragma once
+
+#include "headers.h"
+#include "proc.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+// Where 'time' started measuring: wall clock plus the shell's own usage,
+// since in-process builtins are charged to the shell.
+typedef struct {
+    struct timespec started;
+    struct rusage self;
+} usage_mark;
+
+void usage_mark_now(usage_mark* mark);
+
+// Adds ru into total; max RSS is a maximum, not a sum.
+void rusage_add(struct rusage* total, const struct rusage* ru);
+
+double timespec_seconds_between(const struct timespec* from, const struct timespec* to);
+
+// The 'time' report on stderr: totals, then one line per stage of job (may be NULL)
+void usage_print_report(const usage_mark* mark, const job_t* job);
+
+// CPU seconds and RSS in KiB of a job, reading /proc for processes that are
+// still running. Returns the job's age in seconds.
+double job_usage_summary(const job_t* job, double* cpu_seconds, long* rss_kb);
+
+// Writes s as a quoted, escaped JSON string
+void json_write_string(FILE* out, const char* s);
+
+// Appends a JSON line for a finished job to $SHELL_USAGE_LOG, if set
+void usage_log_job(const job_t* job);
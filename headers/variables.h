@@ -7,17 +7,24 @@ extern char **environ;
 typedef struct var {
     char* name;
     char* value;
-    struct var* next;
+    char* entry;        // "name=value", kept only while exported
+    int exported;
+    size_t env_index;   // slot in the envp array while exported
 } var_t;
 
-extern var_t* var_list;
-
 void set_var(const char *name, const char *value);
 
 void load_environment();
 
 char* get_var(const char *name);
 
+// Marks a variable as exported. Returns -1 if it does not exist.
+int export_var(const char *name);
+
+// NULL-terminated "name=value" array of exported variables, kept up to
+// date by set/export/unset so it can be handed straight to execve.
+char** var_environ(void);
+
 void print_all_var();
 
-void unset_var(char* name);
\ No newline at end of file
+void unset_var(const char* name);
@@ -0,0 +1,116 @@
+#include "../headers/arena.h"
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static arena_block* new_block(size_t min_size) {
+    size_t size = min_size > ARENA_BLOCK_SIZE ? align_up(min_size) : ARENA_BLOCK_SIZE;
+    arena_block* block = malloc(sizeof(arena_block) + size);
+    if (block == NULL) {
+        perror("allocation failed");
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void* arena_alloc(arena* a, size_t size) {
+    size = align_up(size ? size : 1);
+
+    if (a->current == NULL) {
+        a->head = a->current = new_block(size);
+        if (a->head == NULL) return NULL;
+    }
+
+    arena_block* block = a->current;
+    while (block->used + size > block->size) {
+        // after a reset the next block is empty and can be reused as is
+        if (block->next && block->next->size >= size) {
+            block = block->next;
+            block->used = 0;
+            continue;
+        }
+
+        arena_block* fresh = new_block(size);
+        if (fresh == NULL) return NULL;
+        fresh->next = block->next;
+        block->next = fresh;
+        block = fresh;
+    }
+
+    a->current = block;
+    void* ptr = block->data + block->used;
+    block->used += size;
+    a->last = ptr;
+    return ptr;
+}
+
+// Grows ptr (which held old_size bytes) to new_size. The latest allocation
+// is extended in place when its block has room; anything else is copied.
+void* arena_grow(arena* a, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL)
+        return arena_alloc(a, new_size);
+
+    arena_block* block = a->current;
+    if (ptr == a->last) {
+        size_t offset = (char*)ptr - block->data;
+        if (offset + align_up(new_size) <= block->size) {
+            block->used = offset + align_up(new_size);
+            return ptr;
+        }
+    }
+
+    void* moved = arena_alloc(a, new_size);
+    if (moved != NULL)
+        memcpy(moved, ptr, old_size);
+    return moved;
+}
+
+char* arena_strndup(arena* a, const char* s, size_t len) {
+    char* copy = arena_alloc(a, len + 1);
+    if (copy == NULL) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* arena_strdup(arena* a, const char* s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+arena_mark arena_save(arena* a) {
+    arena_mark mark = { a->current, a->current ? a->current->used : 0 };
+    return mark;
+}
+
+// Frees everything allocated since the mark was taken
+void arena_restore(arena* a, arena_mark mark) {
+    if (mark.block == NULL) {
+        arena_reset(a);
+        return;
+    }
+    a->current = mark.block;
+    a->current->used = mark.used;
+    a->last = NULL;
+}
+
+void arena_reset(arena* a) {
+    a->current = a->head;
+    if (a->current)
+        a->current->used = 0;
+    a->last = NULL;
+}
+
+void arena_free(arena* a) {
+    arena_block* block = a->head;
+    while (block) {
+        arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    a->head = a->current = NULL;
+    a->last = NULL;
+}
@@ -0,0 +1,363 @@
+#include "../headers/arith.h"
+#include "../headers/variables.h"
+
+#define ARITH_NAME_MAX 128
+
+// Recursive descent over the expression text, evaluating as it goes.
+// Operands skipped by && || ?: are parsed with eval off, so they neither
+// assign nor fail on a division by zero.
+typedef struct {
+    const char* p;
+    const char* error;
+} arith_state;
+
+typedef struct {
+    const char* name;   // set when the value came straight from a variable
+    size_t name_len;
+    long long value;
+} operand;
+
+static long long parse_comma(arith_state* s, int eval);
+static long long parse_assign(arith_state* s, int eval);
+
+static void skip_space(arith_state* s) {
+    while (*s->p == ' ' || *s->p == '\t' || *s->p == '\n')
+        s->p++;
+}
+
+static int fail(arith_state* s, const char* error) {
+    if (s->error == NULL) s->error = error;
+    return 0;
+}
+
+static int is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+static long long read_var(arith_state* s, const char* name, size_t len) {
+    char buf[ARITH_NAME_MAX];
+    if (len >= sizeof(buf)) return fail(s, "variable name too long");
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    const char* value = get_var(buf);
+    if (value == NULL || *value == '\0') return 0;
+
+    char* end;
+    long long n = strtoll(value, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end != '\0') return fail(s, "variable is not a number");
+    return n;
+}
+
+static void write_var(arith_state* s, const char* name, size_t len, long long value) {
+    char buf[ARITH_NAME_MAX];
+    if (len >= sizeof(buf)) {
+        fail(s, "variable name too long");
+        return;
+    }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    char text[ARITH_TEXT_SIZE];
+    arith_format(value, text);
+    set_var(buf, text);
+}
+
+// Wrapping arithmetic: overflow is defined, as in other shells
+static long long wrap_add(long long a, long long b) { return (long long)((unsigned long long)a + b); }
+static long long wrap_sub(long long a, long long b) { return (long long)((unsigned long long)a - b); }
+static long long wrap_mul(long long a, long long b) { return (long long)((unsigned long long)a * b); }
+
+static long long apply(arith_state* s, const char* op, long long a, long long b, int eval) {
+    switch (op[0]) {
+        case '+': return wrap_add(a, b);
+        case '-': return wrap_sub(a, b);
+        case '*':
+            if (op[1] == '*') {
+                if (b < 0) return eval ? fail(s, "exponent less than 0") : 0;
+                long long r = 1;
+                for (; b > 0; b >>= 1, a = wrap_mul(a, a))
+                    if (b & 1) r = wrap_mul(r, a);
+                return r;
+            }
+            return wrap_mul(a, b);
+        case '/':
+        case '%':
+            if (b == 0) return eval ? fail(s, "division by 0") : 0;
+            if (b == -1) return (op[0] == '/') ? wrap_sub(0, a) : 0;
+            return (op[0] == '/') ? a / b : a % b;
+        case '<':
+            if (op[1] == '<') return (long long)((unsigned long long)a << (b & 63));
+            return (op[1] == '=') ? a <= b : a < b;
+        case '>':
+            if (op[1] == '>') return a >> (b & 63);
+            return (op[1] == '=') ? a >= b : a > b;
+        case '=': return a == b;
+        case '!': return a != b;
+        case '&': return a & b;
+        case '^': return a ^ b;
+        case '|': return a | b;
+    }
+    return 0;
+}
+
+// The binary operator at p and its precedence, from || (1) up to ** (11).
+// Returns its length, or 0 when p isn't one.
+static int match_binary(const char* p, int* prec) {
+    char c = p[0];
+    int len = (p[1] == c) ? 2 : 1;
+    switch (c) {
+        case '|': *prec = (len == 2) ? 1 : 3; break;
+        case '&': *prec = (len == 2) ? 2 : 5; break;
+        case '^': *prec = 4; break;
+        case '*': *prec = (len == 2) ? 11 : 10; break;
+        case '/':
+        case '%': *prec = 10; len = 1; break;
+        case '+':
+        case '-':
+            // a ++/-- belongs to the next operand
+            if (len == 2) return 0;
+            *prec = 9;
+            break;
+        case '=':
+        case '!':
+            if (p[1] != '=') return 0;
+            *prec = 6;
+            return 2;
+        case '<':
+        case '>':
+            if (p[1] == '=') {
+                *prec = 7;
+                return 2;
+            }
+            *prec = (len == 2) ? 8 : 7;
+            break;
+        default:
+            return 0;
+    }
+    // an assignment (a += 1, a <<= 1) is not this operator
+    return (p[len] == '=') ? 0 : len;
+}
+
+static operand parse_primary(arith_state* s, int eval) {
+    operand r = { NULL, 0, 0 };
+    skip_space(s);
+
+    if (*s->p == '(') {
+        s->p++;
+        r.value = parse_comma(s, eval);
+        skip_space(s);
+        if (*s->p != ')') {
+            fail(s, "missing `)'");
+            return r;
+        }
+        s->p++;
+        return r;
+    }
+
+    if (*s->p >= '0' && *s->p <= '9') {
+        char* end;
+        int base = (s->p[0] == '0' && (s->p[1] == 'x' || s->p[1] == 'X')) ? 16
+                 : (s->p[0] == '0') ? 8 : 10;
+        r.value = (long long)strtoull(s->p, &end, base);
+        if (is_name_char(*end)) {
+            fail(s, "value too great for base");
+            return r;
+        }
+        s->p = end;
+        return r;
+    }
+
+    // $name and ${name} mean the same as name
+    int braced = 0;
+    if (*s->p == '$') {
+        s->p++;
+        if (*s->p == '{') {
+            braced = 1;
+            s->p++;
+        }
+    }
+
+    if (!is_name_start(*s->p)) {
+        fail(s, *s->p ? "syntax error: operand expected" : "syntax error: missing operand");
+        return r;
+    }
+
+    r.name = s->p;
+    while (is_name_char(*s->p)) s->p++;
+    r.name_len = s->p - r.name;
+    if (braced) {
+        if (*s->p != '}') {
+            fail(s, "bad substitution");
+            return r;
+        }
+        s->p++;
+    }
+    r.value = read_var(s, r.name, r.name_len);
+    return r;
+}
+
+static long long parse_unary(arith_state* s, int eval) {
+    skip_space(s);
+    char c = *s->p;
+
+    if ((c == '+' || c == '-') && s->p[1] == c) {
+        s->p += 2;
+        operand target = parse_primary(s, eval);
+        if (target.name == NULL) return fail(s, "++/-- needs a variable");
+        long long value = (c == '+') ? wrap_add(target.value, 1) : wrap_sub(target.value, 1);
+        if (eval) write_var(s, target.name, target.name_len, value);
+        return value;
+    }
+    if (c == '+' || c == '-' || c == '!' || c == '~') {
+        s->p++;
+        long long value = parse_unary(s, eval);
+        switch (c) {
+            case '-': return wrap_sub(0, value);
+            case '!': return !value;
+            case '~': return ~value;
+            default: return value;
+        }
+    }
+
+    operand r = parse_primary(s, eval);
+    skip_space(s);
+    if (r.name && (s->p[0] == '+' || s->p[0] == '-') && s->p[1] == s->p[0]) {
+        long long value = (s->p[0] == '+') ? wrap_add(r.value, 1) : wrap_sub(r.value, 1);
+        s->p += 2;
+        if (eval) write_var(s, r.name, r.name_len, value);
+    }
+    return r.value;
+}
+
+static long long parse_binary(arith_state* s, int min_prec, int eval) {
+    long long left = parse_unary(s, eval);
+
+    while (s->error == NULL) {
+        skip_space(s);
+        int prec;
+        int len = match_binary(s->p, &prec);
+        if (len == 0 || prec < min_prec) break;
+
+        const char* op = s->p;
+        s->p += len;
+
+        if (prec == 1 || prec == 2) {
+            // the right side only counts if the left didn't decide it
+            int decided = (prec == 1) ? left != 0 : left == 0;
+            long long right = parse_binary(s, prec + 1, eval && !decided);
+            left = decided ? (prec == 1) : right != 0;
+            continue;
+        }
+
+        // ** groups to the right, everything else to the left
+        long long right = parse_binary(s, (prec == 11) ? prec : prec + 1, eval);
+        left = apply(s, op, left, right, eval);
+    }
+    return left;
+}
+
+static long long parse_ternary(arith_state* s, int eval) {
+    long long cond = parse_binary(s, 1, eval);
+    skip_space(s);
+    if (*s->p != '?') return cond;
+
+    s->p++;
+    long long yes = parse_assign(s, eval && cond);
+    skip_space(s);
+    if (*s->p != ':') return fail(s, "expected `:' in conditional");
+    s->p++;
+    long long no = parse_assign(s, eval && !cond);
+    return cond ? yes : no;
+}
+
+// The length of the assignment operator at p ("=", "+=", "<<=", ...), or 0
+static int match_assign(const char* p) {
+    if (p[0] == '=')
+        return (p[1] == '=') ? 0 : 1;   // '==' compares
+    if ((p[0] == '<' || p[0] == '>') && p[1] == p[0] && p[2] == '=')
+        return 3;
+    if (p[0] != '\0' && p[1] == '=' && strchr("+-*/%&^|", p[0]) != NULL)
+        return 2;
+    return 0;
+}
+
+static long long parse_assign(arith_state* s, int eval) {
+    skip_space(s);
+    const char* start = s->p;
+
+    if (is_name_start(*s->p)) {
+        const char* name = s->p;
+        while (is_name_char(*s->p)) s->p++;
+        size_t name_len = s->p - name;
+        skip_space(s);
+
+        int len = match_assign(s->p);
+        if (len > 0) {
+            char op[3] = { s->p[0], (len == 3) ? s->p[1] : '\0', '\0' };
+            s->p += len;
+            long long value = parse_assign(s, eval);
+            if (len > 1)
+                value = apply(s, op, read_var(s, name, name_len), value, eval);
+            if (eval && s->error == NULL) write_var(s, name, name_len, value);
+            return value;
+        }
+        s->p = start;
+    }
+    return parse_ternary(s, eval);
+}
+
+static long long parse_comma(arith_state* s, int eval) {
+    long long value = parse_assign(s, eval);
+    skip_space(s);
+    while (s->error == NULL && *s->p == ',') {
+        s->p++;
+        value = parse_assign(s, eval);
+        skip_space(s);
+    }
+    return value;
+}
+
+size_t arith_format(long long value, char* out) {
+    char digits[ARITH_TEXT_SIZE];
+    size_t n = 0;
+    // through unsigned so LLONG_MIN negates cleanly
+    unsigned long long u = (value < 0) ? 0 - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+
+    size_t len = 0;
+    if (value < 0) out[len++] = '-';
+    while (n) out[len++] = digits[--n];
+    out[len] = '\0';
+    return len;
+}
+
+int arith_eval(const char* expr, long long* result) {
+    arith_state s = { expr, NULL };
+
+    skip_space(&s);
+    // $(( )) is 0
+    if (*s.p == '\0') {
+        *result = 0;
+        return 0;
+    }
+
+    long long value = parse_comma(&s, 1);
+    if (s.error == NULL && *s.p != '\0')
+        s.error = "syntax error in expression";
+
+    if (s.error) {
+        fprintf(stderr, "%s: %s\n", expr, s.error);
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
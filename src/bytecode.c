@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+
+#include "../headers/bytecode.h"
+#include "../headers/internalfuncs.h"
+#include "../headers/hash.h"
+
+#include <sys/mman.h>
+
+#define BYTECODE_MAGIC "SHBC"
+// Bump whenever the encoding, or what the parser makes of a script, changes
+#define BYTECODE_VERSION 1
+
+// Node opcodes are OP_NODE plus the node_type. Integers are LEB128
+// varints. Strings are kept once each in a pool ahead of the code and
+// referred to by their offset + 1 (0 for NULL), so decoded strings point
+// straight into the map.
+enum {
+    OP_NONE = 0,       // an absent node
+    OP_NODE = 1,
+    OP_SIMPLE = 32,    // builtin + 2, words, redirections, OP_END
+    OP_COMPOUND,       // subshell flag, name, body, redirections, OP_END
+    OP_REDIR_IN,       // < word
+    OP_REDIR_OUT,      // > word
+    OP_REDIR_APPEND,   // >> word
+    OP_END,
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t builtins;    // hash of the internals[] names, in order
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t pool_len;
+    uint64_t code_len;
+    uint64_t checksum;    // of the pool and the code
+    uint32_t path_len;    // the script's absolute path follows the header
+    uint32_t units;
+} bytecode_header;
+
+// Resolved builtins are stored by index, so a different table means a
+// different cache
+static uint64_t builtins_hash(void) {
+    uint64_t h = FNV1A_SEED;
+    for (int i = 0; internals[i].name != NULL; ++i)
+        h = fnv1a(h, internals[i].name, strlen(internals[i].name) + 1);
+    return h;
+}
+
+static int builtin_count(void) {
+    int n = 0;
+    while (internals[n].name != NULL) ++n;
+    return n;
+}
+
+// dir/<hash of the absolute path>, or -1 when there is nowhere to cache
+static int cache_file(char* out, size_t size, const char* abs_path, char* dir, size_t dir_size) {
+    const char* off = getenv("SHELL_NO_CACHE");
+    if (off && *off) return -1;
+
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    int n;
+    if (xdg && *xdg)
+        n = snprintf(dir, dir_size, "%s/shell", xdg);
+    else if (home && *home)
+        n = snprintf(dir, dir_size, "%s/.cache/shell", home);
+    else
+        return -1;
+    if (n < 0 || (size_t)n >= dir_size) return -1;
+
+    uint64_t h = fnv1a(FNV1A_SEED, abs_path, strlen(abs_path));
+    n = snprintf(out, size, "%s/%016llx", dir, (unsigned long long)h);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// --- Writing ---
+
+void bytecode_writer_init(bytecode_writer* w) {
+    memset(w, 0, sizeof(*w));
+}
+
+void bytecode_writer_free(bytecode_writer* w) {
+    free(w->code.bytes);
+    free(w->pool.bytes);
+    free(w->slots);
+    memset(w, 0, sizeof(*w));
+}
+
+static void append(bytecode_writer* w, bytecode_buffer* b, const void* data, size_t len) {
+    if (w->failed) return;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len) cap *= 2;
+        unsigned char* grown = realloc(b->bytes, cap);
+        if (grown == NULL) {
+            w->failed = 1;
+            return;
+        }
+        b->bytes = grown;
+        b->cap = cap;
+    }
+    memcpy(b->bytes + b->len, data, len);
+    b->len += len;
+}
+
+static void put_byte(bytecode_writer* w, unsigned char b) {
+    append(w, &w->code, &b, 1);
+}
+
+static void put_varint(bytecode_writer* w, uint64_t v) {
+    unsigned char buf[10];
+    size_t n = 0;
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v) buf[n] |= 0x80;
+        ++n;
+    } while (v);
+    append(w, &w->code, buf, n);
+}
+
+static size_t find_string(const bytecode_writer* w, const char* s, size_t len) {
+    size_t mask = w->slot_count - 1;
+    size_t i = fnv1a(FNV1A_SEED, s, len) & mask;
+    while (w->slots[i] && strcmp((char*)w->pool.bytes + w->slots[i] - 1, s) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int grow_slots(bytecode_writer* w) {
+    size_t old_count = w->slot_count;
+    uint32_t* old = w->slots;
+    w->slot_count = old_count ? old_count * 2 : 1024;
+    w->slots = calloc(w->slot_count, sizeof(uint32_t));
+    if (w->slots == NULL) {
+        w->slots = old;
+        w->slot_count = old_count;
+        return -1;
+    }
+    for (size_t i = 0; i < old_count; ++i) {
+        if (old[i] == 0) continue;
+        const char* s = (char*)w->pool.bytes + old[i] - 1;
+        w->slots[find_string(w, s, strlen(s))] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// A word like 'true' or 'fi' is in the pool once however often it is
+// used. Returns the reference to s.
+static uint64_t intern_string(bytecode_writer* w, const char* s) {
+    if (s == NULL || w->failed)
+        return 0;
+    if ((w->string_count + 1) * 2 > w->slot_count && grow_slots(w) < 0) {
+        w->failed = 1;
+        return 0;
+    }
+
+    size_t len = strlen(s);
+    size_t slot = find_string(w, s, len);
+    if (w->slots[slot] == 0) {
+        if (w->pool.len + len + 1 >= UINT32_MAX) {
+            w->failed = 1;
+            return 0;
+        }
+        w->slots[slot] = w->pool.len + 1;
+        w->string_count++;
+        append(w, &w->pool, s, len + 1);
+    }
+    return w->slots[slot];
+}
+
+static void put_string(bytecode_writer* w, const char* s) {
+    put_varint(w, intern_string(w, s));
+}
+
+// Most words are one literal, stored as a single varint: the string
+// reference, the quoted flag and a 1. Others have their part count there
+// instead of the reference, and a 0.
+static void put_word(bytecode_writer* w, const word* wd) {
+    if (wd->literal) {
+        put_varint(w, intern_string(w, wd->literal) << 2 | (wd->quoted != 0) << 1 | 1);
+        return;
+    }
+
+    size_t count = 0;
+    for (const word_part* part = wd->parts; part; part = part->next)
+        ++count;
+
+    put_varint(w, count << 2 | (wd->quoted != 0) << 1);
+    for (const word_part* part = wd->parts; part; part = part->next) {
+        put_byte(w, part->type);
+        put_string(w, part->text);
+    }
+}
+
+static void put_words(bytecode_writer* w, const word* words, size_t count) {
+    put_varint(w, count);
+    for (size_t i = 0; i < count; ++i)
+        put_word(w, &words[i]);
+}
+
+static void put_node(bytecode_writer* w, const node* n);
+
+static void put_redirects(bytecode_writer* w, const command* cmd) {
+    if (cmd->inputWord) {
+        put_byte(w, OP_REDIR_IN);
+        put_word(w, cmd->inputWord);
+    }
+    if (cmd->outputWord) {
+        put_byte(w, cmd->appendOutput ? OP_REDIR_APPEND : OP_REDIR_OUT);
+        put_word(w, cmd->outputWord);
+    }
+    put_byte(w, OP_END);
+}
+
+static void put_command(bytecode_writer* w, const command* cmd) {
+    if (cmd->body) {
+        put_byte(w, OP_COMPOUND);
+        put_varint(w, cmd->subshell != 0);
+        put_string(w, cmd->argv[0]);
+        put_node(w, cmd->body);
+    } else {
+        put_byte(w, OP_SIMPLE);
+        put_varint(w, (uint64_t)(cmd->builtin + 2));
+        put_words(w, cmd->words, cmd->wordc);
+    }
+    put_redirects(w, cmd);
+}
+
+static void put_node(bytecode_writer* w, const node* n) {
+    if (n == NULL) {
+        put_byte(w, OP_NONE);
+        return;
+    }
+    put_byte(w, OP_NODE + n->type);
+
+    if (n->type == NODE_PIPELINE) {
+        const pipeline* p = n->pipeline;
+        // the pipe settings are rare: flagged, and only then written
+        put_varint(w, (p->background != 0) | (p->timed != 0) << 1
+                      | (p->pipe_capacity != NULL) << 2 | (p->pipe_packet != NULL) << 3);
+        put_string(w, p->buffer);
+        if (p->pipe_capacity) put_string(w, p->pipe_capacity);
+        if (p->pipe_packet) put_string(w, p->pipe_packet);
+        put_varint(w, p->cmdc);
+        for (size_t i = 0; i < p->cmdc; ++i)
+            put_command(w, p->cmds[i]);
+        return;
+    }
+
+    // only a list in the background has its text kept
+    put_varint(w, n->background != 0);
+    if (n->background) put_string(w, n->text);
+    switch (n->type) {
+        case NODE_FOR:
+            put_string(w, n->name);
+            put_words(w, n->words, n->wordc);
+            put_node(w, n->right);
+            break;
+        case NODE_CASE:
+            put_words(w, n->words, n->wordc);
+            put_varint(w, n->itemc);
+            for (size_t i = 0; i < n->itemc; ++i) {
+                put_words(w, n->items[i].patterns, n->items[i].patternc);
+                put_node(w, n->items[i].body);
+            }
+            break;
+        default:
+            put_node(w, n->left);
+            put_node(w, n->right);
+            put_node(w, n->alternative);
+            break;
+    }
+}
+
+void bytecode_add(bytecode_writer* w, const node* tree, const char* text) {
+    put_string(w, text);
+    put_node(w, tree);
+    w->units++;
+}
+
+static int write_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// The cache is only an optimization: failing to write it is not an error
+int bytecode_save(bytecode_writer* w, const char* path, const struct stat* st) {
+    if (w->failed) return -1;
+
+    char abs_path[PATH_MAX], dir[PATH_MAX], file[PATH_MAX];
+    if (realpath(path, abs_path) == NULL) return -1;
+    if (cache_file(file, sizeof(file), abs_path, dir, sizeof(dir)) < 0) return -1;
+
+    // ~/.cache may not exist yet either
+    char* slash = strrchr(dir, '/');
+    *slash = '\0';
+    mkdir(dir, 0700);
+    *slash = '/';
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) return -1;
+
+    bytecode_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BYTECODE_MAGIC, 4);
+    h.version = BYTECODE_VERSION;
+    h.builtins = builtins_hash();
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.size = st->st_size;
+    h.pool_len = w->pool.len;
+    h.code_len = w->code.len;
+    h.checksum = fnv1a(fnv1a(FNV1A_SEED, w->pool.bytes, w->pool.len), w->code.bytes, w->code.len);
+    h.path_len = strlen(abs_path);
+    h.units = w->units;
+
+    // written aside and renamed, so a reader never sees half an entry
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= (int)sizeof(tmp)) return -1;
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    int err = write_all(fd, &h, sizeof(h)) < 0 || write_all(fd, abs_path, h.path_len) < 0
+              || write_all(fd, w->pool.bytes, w->pool.len) < 0
+              || write_all(fd, w->code.bytes, w->code.len) < 0;
+    close(fd);
+    if (err || rename(tmp, file) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// --- Reading ---
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    char* pool;
+    size_t pool_len;
+    arena* a;
+    int bad;
+} decoder;
+
+static int get_byte(decoder* d) {
+    if (d->p >= d->end) {
+        d->bad = 1;
+        return -1;
+    }
+    return *d->p++;
+}
+
+static uint64_t get_varint(decoder* d) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = get_byte(d);
+        if (b < 0) return 0;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    d->bad = 1;
+    return 0;
+}
+
+// Counts that size an allocation: anything bigger than what is left of
+// the code can't be right
+static size_t get_count(decoder* d) {
+    uint64_t n = get_varint(d);
+    if (n > (uint64_t)(d->end - d->p)) {
+        d->bad = 1;
+        return 0;
+    }
+    return n;
+}
+
+// The pool ends in a NUL, so any offset into it is a whole string
+static char* get_string(decoder* d) {
+    uint64_t ref = get_varint(d);
+    if (ref == 0) return NULL;
+    if (ref > d->pool_len) {
+        d->bad = 1;
+        return NULL;
+    }
+    return d->pool + ref - 1;
+}
+
+static void* get_array(decoder* d, size_t count, size_t size) {
+    if (count == 0) return NULL;
+    void* p = arena_alloc(d->a, count * size);
+    if (p == NULL) d->bad = 1;
+    return p;
+}
+
+static int add_part(decoder* d, word_part*** tail, int type, char* text) {
+    word_part* part = arena_alloc(d->a, sizeof(word_part));
+    if (part == NULL || text == NULL || type < PART_LITERAL || type > PART_ARITH) {
+        d->bad = 1;
+        return -1;
+    }
+    part->type = type;
+    part->text = text;
+    part->len = strlen(text);
+    part->next = NULL;
+    **tail = part;
+    *tail = &part->next;
+    return 0;
+}
+
+static void get_word(decoder* d, word* out) {
+    uint64_t head = get_varint(d);
+    out->parts = NULL;
+    out->literal = NULL;
+    out->quoted = (head >> 1) & 1;
+    word_part** tail = &out->parts;
+
+    if (head & 1) {
+        uint64_t ref = head >> 2;
+        if (ref == 0 || ref > d->pool_len) {
+            d->bad = 1;
+            return;
+        }
+        if (add_part(d, &tail, PART_LITERAL, d->pool + ref - 1) == 0)
+            out->literal = out->parts->text;
+        return;
+    }
+
+    size_t count = head >> 2;
+    for (size_t i = 0; i < count && !d->bad; ++i) {
+        int type = get_byte(d);
+        add_part(d, &tail, type, get_string(d));
+    }
+    if (out->parts == NULL)
+        d->bad = 1;
+}
+
+static word* get_words(decoder* d, size_t* count) {
+    *count = get_count(d);
+    word* words = get_array(d, *count, sizeof(word));
+    for (size_t i = 0; i < *count && !d->bad; ++i)
+        get_word(d, &words[i]);
+    return words;
+}
+
+static word* get_one_word(decoder* d) {
+    word* w = arena_alloc(d->a, sizeof(word));
+    if (w == NULL) {
+        d->bad = 1;
+        return NULL;
+    }
+    get_word(d, w);
+    return w;
+}
+
+static node* get_node(decoder* d);
+
+static command* get_command(decoder* d) {
+    command* cmd = arena_alloc(d->a, sizeof(command));
+    if (cmd == NULL) {
+        d->bad = 1;
+        return NULL;
+    }
+    *cmd = command_default;
+
+    int op = get_byte(d);
+    if (op == OP_COMPOUND) {
+        cmd->subshell = (int)get_varint(d);
+        cmd->builtin = BUILTIN_NONE;
+        char** argv = get_array(d, 2, sizeof(char*));
+        if (argv == NULL) return NULL;
+        argv[0] = get_string(d);
+        argv[1] = NULL;
+        cmd->argv = argv;
+        cmd->argc = 1;
+        cmd->body = get_node(d);
+        if (argv[0] == NULL || cmd->body == NULL) d->bad = 1;
+    } else if (op == OP_SIMPLE) {
+        int64_t builtin = (int64_t)get_varint(d) - 2;
+        if (builtin < BUILTIN_UNRESOLVED || builtin >= builtin_count()) d->bad = 1;
+        cmd->builtin = (int)builtin;
+        cmd->words = get_words(d, &cmd->wordc);
+    } else {
+        d->bad = 1;
+    }
+
+    while (!d->bad) {
+        op = get_byte(d);
+        if (op == OP_END) break;
+        if (op == OP_REDIR_IN) {
+            cmd->inputWord = get_one_word(d);
+        } else if (op == OP_REDIR_OUT || op == OP_REDIR_APPEND) {
+            cmd->outputWord = get_one_word(d);
+            cmd->appendOutput = (op == OP_REDIR_APPEND);
+        } else {
+            d->bad = 1;
+        }
+    }
+    return d->bad ? NULL : cmd;
+}
+
+static node* get_node(decoder* d) {
+    int op = get_byte(d);
+    if (op <= OP_NONE) return NULL;
+    if (op > OP_NODE + NODE_CASE) {
+        d->bad = 1;
+        return NULL;
+    }
+
+    node* n = arena_alloc(d->a, sizeof(node));
+    if (n == NULL) {
+        d->bad = 1;
+        return NULL;
+    }
+    memset(n, 0, sizeof(*n));
+    n->type = op - OP_NODE;
+
+    if (n->type == NODE_PIPELINE) {
+        pipeline* p = arena_alloc(d->a, sizeof(pipeline));
+        if (p == NULL) {
+            d->bad = 1;
+            return NULL;
+        }
+        *p = pipeline_default;
+        uint64_t flags = get_varint(d);
+        p->background = flags & 1;
+        p->timed = (flags >> 1) & 1;
+        p->buffer = get_string(d);
+        if (flags & 4) p->pipe_capacity = get_string(d);
+        if (flags & 8) p->pipe_packet = get_string(d);
+        p->cmdc = get_count(d);
+        p->cmds = get_array(d, p->cmdc, sizeof(command*));
+        for (size_t i = 0; i < p->cmdc && !d->bad; ++i)
+            p->cmds[i] = get_command(d);
+        if (p->buffer == NULL) d->bad = 1;
+        n->pipeline = p;
+        return d->bad ? NULL : n;
+    }
+
+    n->background = (int)get_varint(d);
+    if (n->background) n->text = get_string(d);
+    switch (n->type) {
+        case NODE_FOR:
+            n->name = get_string(d);
+            n->words = get_words(d, &n->wordc);
+            n->right = get_node(d);
+            if (n->name == NULL) d->bad = 1;
+            break;
+        case NODE_CASE:
+            n->words = get_words(d, &n->wordc);
+            n->itemc = get_count(d);
+            n->items = get_array(d, n->itemc, sizeof(case_item));
+            for (size_t i = 0; i < n->itemc && !d->bad; ++i) {
+                n->items[i].patterns = get_words(d, &n->items[i].patternc);
+                n->items[i].body = get_node(d);
+            }
+            if (n->wordc != 1) d->bad = 1;
+            break;
+        default:
+            n->left = get_node(d);
+            n->right = get_node(d);
+            n->alternative = get_node(d);
+            break;
+    }
+    return d->bad ? NULL : n;
+}
+
+int bytecode_open(bytecode_program* prog, const char* path, const struct stat* st) {
+    memset(prog, 0, sizeof(*prog));
+
+    char abs_path[PATH_MAX], dir[PATH_MAX], file[PATH_MAX];
+    if (realpath(path, abs_path) == NULL) return -1;
+    if (cache_file(file, sizeof(file), abs_path, dir, sizeof(dir)) < 0) return -1;
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat cache_st;
+    if (fstat(fd, &cache_st) < 0 || (size_t)cache_st.st_size < sizeof(bytecode_header)) {
+        close(fd);
+        return -1;
+    }
+
+    // private and writable: the tree's strings live in it, and nothing
+    // written to them may reach the file
+    size_t size = cache_st.st_size;
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    bytecode_header h;
+    memcpy(&h, map, sizeof(h));
+    size_t path_len = strlen(abs_path);
+    int valid = memcmp(h.magic, BYTECODE_MAGIC, 4) == 0
+                && h.version == BYTECODE_VERSION
+                && h.builtins == builtins_hash()
+                && h.mtime_sec == st->st_mtim.tv_sec && h.mtime_nsec == st->st_mtim.tv_nsec
+                && h.size == (uint64_t)st->st_size
+                && h.path_len == path_len
+                && h.pool_len < size && h.code_len < size
+                && sizeof(h) + (uint64_t)h.path_len + h.pool_len + h.code_len == size
+                && memcmp((char*)map + sizeof(h), abs_path, path_len) == 0;
+
+    char* pool = (char*)map + sizeof(h) + path_len;
+    const unsigned char* code = (const unsigned char*)pool + h.pool_len;
+    if (valid && (h.pool_len > 0 && pool[h.pool_len - 1] != '\0'))
+        valid = 0;
+    if (valid && fnv1a(fnv1a(FNV1A_SEED, pool, h.pool_len), code, h.code_len) != h.checksum)
+        valid = 0;
+    if (!valid) {
+        munmap(map, size);
+        return -1;
+    }
+
+    prog->map = map;
+    prog->map_size = size;
+    prog->pool = pool;
+    prog->pool_len = h.pool_len;
+    prog->pos = code;
+    prog->end = code + h.code_len;
+    prog->units_left = h.units;
+    return 0;
+}
+
+node* bytecode_next(bytecode_program* prog, arena* a, const char** text) {
+    if (prog->units_left == 0) return NULL;
+
+    decoder d = { prog->pos, prog->end, prog->pool, prog->pool_len, a, 0 };
+    *text = get_string(&d);
+    node* tree = get_node(&d);
+    if (d.bad || tree == NULL || *text == NULL) {
+        prog->units_left = 0;
+        return NULL;
+    }
+    prog->pos = d.p;
+    prog->units_left--;
+    return tree;
+}
+
+int bytecode_at_end(const bytecode_program* prog) {
+    return prog->units_left == 0;
+}
+
+void bytecode_close(bytecode_program* prog) {
+    if (prog->map)
+        munmap(prog->map, prog->map_size);
+    memset(prog, 0, sizeof(*prog));
+}
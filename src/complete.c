@@ -0,0 +1,294 @@
+#include "../headers/complete.h"
+#include "../headers/internalfuncs.h"
+#include "../headers/variables.h"
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+typedef struct {
+    char** names;       // sorted
+    size_t count;
+} name_list;
+
+// One PATH directory, rescanned only when its mtime moves
+typedef struct {
+    char* path;
+    struct timespec mtime;
+    int scanned;
+    name_list list;
+} path_dir;
+
+static path_dir* path_dirs = NULL;
+static size_t path_dir_count = 0;
+static char* indexed_path = NULL;
+
+// Every command name, sorted and unique; points into the lists above
+static const char** commands = NULL;
+static size_t command_count = 0;
+
+// Directories scanned for filename completion, least recently used evicted
+typedef struct {
+    char* path;         // absolute
+    struct timespec mtime;
+    unsigned long used;
+    name_list list;
+} dir_entry;
+
+static dir_entry dir_cache[COMPLETE_DIR_CACHE];
+static unsigned long dir_clock = 0;
+
+// Candidates handed out in a completion
+static const char** scratch = NULL;
+static size_t scratch_cap = 0;
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static void free_list(name_list* list) {
+    for (size_t i = 0; i < list->count; ++i)
+        free(list->names[i]);
+    free(list->names);
+    list->names = NULL;
+    list->count = 0;
+}
+
+static int list_push(name_list* list, size_t* cap, const char* name, int slash) {
+    if (list->count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        char** grown = realloc(list->names, new_cap * sizeof(char*));
+        if (grown == NULL) return -1;
+        list->names = grown;
+        *cap = new_cap;
+    }
+    size_t len = strlen(name);
+    char* copy = malloc(len + 2);
+    if (copy == NULL) return -1;
+    memcpy(copy, name, len);
+    copy[len] = '/';
+    copy[len + slash] = '\0';
+    list->names[list->count++] = copy;
+    return 0;
+}
+
+// Reads a directory into a sorted list. With executables_only, keeps
+// regular files we may execute; otherwise everything, dirs marked with '/'.
+static int scan_dir(const char* path, int executables_only, name_list* out) {
+    out->names = NULL;
+    out->count = 0;
+    size_t cap = 0;
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) return -1;
+    int fd = dirfd(dir);
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char* name = ent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        int is_dir = ent->d_type == DT_DIR;
+        int is_reg = ent->d_type == DT_REG;
+        if (ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(fd, name, &st, 0) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+                is_reg = S_ISREG(st.st_mode);
+            }
+        }
+
+        if (executables_only) {
+            if (!is_reg || faccessat(fd, name, X_OK, 0) != 0) continue;
+            list_push(out, &cap, name, 0);
+        } else {
+            list_push(out, &cap, name, is_dir);
+        }
+    }
+    closedir(dir);
+
+    qsort(out->names, out->count, sizeof(char*), compare_names);
+    return 0;
+}
+
+static int same_time(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void reset_path_dirs(const char* path) {
+    for (size_t i = 0; i < path_dir_count; ++i) {
+        free(path_dirs[i].path);
+        free_list(&path_dirs[i].list);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    path_dir_count = 0;
+    free(indexed_path);
+    indexed_path = strdup(path);
+
+    size_t n = 1;
+    for (const char* p = path; *p; ++p)
+        if (*p == ':') ++n;
+    path_dirs = calloc(n, sizeof(path_dir));
+    if (path_dirs == NULL) return;
+
+    const char* dir = path;
+    while (1) {
+        const char* end = strchr(dir, ':');
+        size_t len = end ? (size_t)(end - dir) : strlen(dir);
+        // an empty entry means the current directory
+        path_dirs[path_dir_count++].path = len ? strndup(dir, len) : strdup(".");
+        if (end == NULL) break;
+        dir = end + 1;
+    }
+}
+
+// Costs one stat per PATH directory when nothing changed
+static void refresh_commands(void) {
+    const char* path = get_var("PATH");
+    if (path == NULL) path = DEFAULT_PATH;
+
+    int changed = 0;
+    if (indexed_path == NULL || strcmp(indexed_path, path) != 0) {
+        reset_path_dirs(path);
+        changed = 1;
+    }
+
+    for (size_t i = 0; i < path_dir_count; ++i) {
+        path_dir* d = &path_dirs[i];
+        struct stat st;
+        if (stat(d->path, &st) < 0) {
+            if (d->scanned) {
+                free_list(&d->list);
+                d->scanned = 0;
+                changed = 1;
+            }
+            continue;
+        }
+        if (d->scanned && same_time(&st.st_mtim, &d->mtime))
+            continue;
+
+        free_list(&d->list);
+        scan_dir(d->path, 1, &d->list);
+        d->mtime = st.st_mtim;
+        d->scanned = 1;
+        changed = 1;
+    }
+
+    if (!changed && commands != NULL) return;
+
+    size_t total = 0;
+    for (size_t i = 0; i < path_dir_count; ++i)
+        total += path_dirs[i].list.count;
+    for (int i = 0; internals[i].name != NULL; ++i)
+        ++total;
+
+    free(commands);
+    commands = malloc((total ? total : 1) * sizeof(char*));
+    command_count = 0;
+    if (commands == NULL) return;
+
+    for (size_t i = 0; i < path_dir_count; ++i)
+        for (size_t j = 0; j < path_dirs[i].list.count; ++j)
+            commands[command_count++] = path_dirs[i].list.names[j];
+    for (int i = 0; internals[i].name != NULL; ++i)
+        commands[command_count++] = internals[i].name;
+
+    qsort(commands, command_count, sizeof(char*), compare_names);
+
+    // the same name in two PATH directories is one command
+    size_t unique = 0;
+    for (size_t i = 0; i < command_count; ++i)
+        if (unique == 0 || strcmp(commands[unique - 1], commands[i]) != 0)
+            commands[unique++] = commands[i];
+    command_count = unique;
+}
+
+// Copies the names starting with prefix into scratch; hidden names only
+// when the prefix asks for them
+static void collect(const char* const* names, size_t count, const char* prefix, completion* out) {
+    size_t plen = strlen(prefix);
+
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t n = 0;
+    for (size_t i = lo; i < count && strncmp(names[i], prefix, plen) == 0; ++i) {
+        if (names[i][0] == '.' && prefix[0] != '.') continue;
+        if (n == scratch_cap) {
+            size_t new_cap = scratch_cap ? scratch_cap * 2 : 256;
+            const char** grown = realloc(scratch, new_cap * sizeof(char*));
+            if (grown == NULL) break;
+            scratch = grown;
+            scratch_cap = new_cap;
+        }
+        scratch[n++] = names[i];
+    }
+
+    out->matches = scratch;
+    out->count = n;
+    out->base_len = plen;
+}
+
+void complete_command(const char* word, completion* out) {
+    refresh_commands();
+    collect(commands, command_count, word, out);
+}
+
+static const name_list* cached_dir(const char* path) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) return NULL;
+
+    dir_entry* victim = &dir_cache[0];
+    for (int i = 0; i < COMPLETE_DIR_CACHE; ++i) {
+        dir_entry* e = &dir_cache[i];
+        if (e->path && strcmp(e->path, path) == 0) {
+            if (!same_time(&e->mtime, &st.st_mtim)) {
+                free_list(&e->list);
+                scan_dir(path, 0, &e->list);
+                e->mtime = st.st_mtim;
+            }
+            e->used = ++dir_clock;
+            return &e->list;
+        }
+        if (e->path == NULL || (victim->path && e->used < victim->used))
+            victim = e;
+    }
+
+    free(victim->path);
+    free_list(&victim->list);
+    victim->path = strdup(path);
+    scan_dir(path, 0, &victim->list);
+    victim->mtime = st.st_mtim;
+    victim->used = ++dir_clock;
+    return &victim->list;
+}
+
+void complete_filename(const char* word, completion* out) {
+    out->matches = NULL;
+    out->count = 0;
+    out->base_len = 0;
+
+    const char* slash = strrchr(word, '/');
+    const char* base = slash ? slash + 1 : word;
+
+    // relative directories are cached under their absolute path
+    char dir[PATH_MAX];
+    size_t used = 0;
+    if (word[0] != '/') {
+        if (getcwd(dir, sizeof(dir)) == NULL) return;
+        used = strlen(dir);
+        if (used < sizeof(dir) - 1) dir[used++] = '/';
+    }
+    size_t dir_part = slash ? (size_t)(slash - word + 1) : 0;
+    if (used + dir_part >= sizeof(dir)) return;
+    memcpy(dir + used, word, dir_part);
+    dir[used + dir_part] = '\0';
+
+    const name_list* list = cached_dir(dir);
+    if (list == NULL) return;
+    collect((const char* const*)list->names, list->count, base, out);
+}
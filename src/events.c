@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+
+#include "../headers/events.h"
+#include "../headers/parser.h"
+
+#include <sys/syscall.h>
+
+// Tag stored in the upper half of epoll_data.u64 for non-child fds
+#define EV_SIGNALFD 0xffffffffu
+
+static int child_epfd = -1;   // signalfd + one pidfd per child
+static int input_epfd = -1;   // the terminal + child_epfd, for the line editor
+static int sigchld_fd = -1;
+static int have_pidfd = 1;
+static sigset_t child_mask;   // what the shell's mask was before SIGCHLD got blocked
+
+// Children that couldn't get a pidfd (out of fds, say): their exits are
+// polled for on every SIGCHLD instead
+static pid_t* unwatched = NULL;
+static size_t unwatched_count = 0;
+static size_t unwatched_cap = 0;
+
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int open_child_events(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    child_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sigchld_fd < 0 || child_epfd < 0) {
+        perror("events_init");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)EV_SIGNALFD << 32 };
+    epoll_ctl(child_epfd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    return 0;
+}
+
+// SIGCHLD stays blocked in the shell for good and is read from a signalfd,
+// so children are only ever reaped from events_dispatch.
+int events_init(int watch_input) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &child_mask);
+
+    if (open_child_events() < 0)
+        return -1;
+
+    if (watch_input) {
+        input_epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (input_epfd < 0) {
+            perror("epoll_create1");
+            return -1;
+        }
+
+        struct epoll_event in_ev = { .events = EPOLLIN, .data.fd = STDIN_FILENO };
+        struct epoll_event child_ev = { .events = EPOLLIN, .data.fd = child_epfd };
+        epoll_ctl(input_epfd, EPOLL_CTL_ADD, STDIN_FILENO, &in_ev);
+        epoll_ctl(input_epfd, EPOLL_CTL_ADD, child_epfd, &child_ev);
+    }
+    return 0;
+}
+
+// A forked subshell starts over with its own signalfd and epoll set; the
+// inherited ones belong to the parent's children. Its mask for children
+// stays the one the shell started with.
+int events_reinit_in_child(void) {
+    close(sigchld_fd);
+    close(child_epfd);
+    if (input_epfd >= 0) close(input_epfd);
+    input_epfd = -1;
+    unwatched_count = 0;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    return open_child_events();
+}
+
+// Children start with the mask the shell had before SIGCHLD was blocked
+const sigset_t* events_child_sigmask(void) {
+    return &child_mask;
+}
+
+static void watch_unwatched(pid_t pid) {
+    if (unwatched_count == unwatched_cap) {
+        size_t new_cap = unwatched_cap ? unwatched_cap * 2 : 16;
+        pid_t* grown = realloc(unwatched, new_cap * sizeof(pid_t));
+        if (grown == NULL) {
+            // nothing left to track it with: reap every exit the old way
+            perror("realloc");
+            have_pidfd = 0;
+            return;
+        }
+        unwatched = grown;
+        unwatched_cap = new_cap;
+    }
+    unwatched[unwatched_count++] = pid;
+}
+
+// A pidfd turns readable exactly when its child exits, so the exit can be
+// collected with waitpid(pid) without touching anyone else's children.
+void events_watch_child(pid_t pid) {
+    if (!have_pidfd) return;
+
+    int fd = open_pidfd(pid);
+    if (fd < 0) {
+        if (errno == ENOSYS || errno == EPERM)
+            have_pidfd = 0;
+        else
+            watch_unwatched(pid);
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = ((uint64_t)fd << 32) | (uint32_t)pid };
+    if (epoll_ctl(child_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        watch_unwatched(pid);
+    }
+}
+
+// Returns 1 once the child is gone: reaped now, or by someone else before
+static int try_reap(pid_t pid) {
+    int status;
+    struct rusage usage;
+    pid_t w;
+    do {
+        w = wait4(pid, &status, WNOHANG, &usage);
+    } while (w < 0 && errno == EINTR);
+
+    if (w == pid)
+        handle_child_status(pid, status, &usage);
+    return w != 0;
+}
+
+static void reap_exited(pid_t pid, int fd) {
+    try_reap(pid);
+    close(fd);
+}
+
+static void reap_unwatched(void) {
+    size_t kept = 0;
+    for (size_t i = 0; i < unwatched_count; ++i)
+        if (!try_reap(unwatched[i]))
+            unwatched[kept++] = unwatched[i];
+    unwatched_count = kept;
+}
+
+// Stops and continues don't show up on a pidfd; collect them without
+// WEXITED so exits are still left for their own pidfds. Children without
+// one are checked for exits here too.
+static void reap_state_changes(void) {
+    if (!have_pidfd) {
+        int status;
+        struct rusage usage;
+        pid_t pid;
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+            handle_child_status(pid, status, &usage);
+        return;
+    }
+
+    while (1) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 || info.si_pid == 0)
+            break;
+
+        if (info.si_code == CLD_STOPPED || info.si_code == CLD_TRAPPED)
+            handle_child_state(info.si_pid, JOB_STOPPED);
+        else if (info.si_code == CLD_CONTINUED)
+            handle_child_state(info.si_pid, JOB_RUNNING);
+    }
+    reap_unwatched();
+}
+
+// Handles whatever child events are ready within timeout_ms (-1 blocks
+// until at least one arrives). Returns the number of events handled.
+int events_dispatch(int timeout_ms) {
+    struct epoll_event events[EVENTS_BATCH];
+
+    int n = epoll_wait(child_epfd, events, EVENTS_BATCH, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) perror("epoll_wait");
+        return 0;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        uint32_t tag = events[i].data.u64 >> 32;
+
+        if (tag == EV_SIGNALFD) {
+            struct signalfd_siginfo si[16];
+            while (read(sigchld_fd, si, sizeof(si)) > 0)
+                ;
+            reap_state_changes();
+        } else {
+            reap_exited((pid_t)(uint32_t)events[i].data.u64, (int)tag);
+        }
+    }
+    return n;
+}
+
+// Blocks until the terminal has input, handling child events meanwhile.
+// Returns 1 if finished jobs were announced (the prompt needs redrawing).
+int events_wait_for_input(void) {
+    int announced = 0;
+
+    while (1) {
+        struct epoll_event events[2];
+        int n = epoll_wait(input_epfd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return announced;
+        }
+
+        int input_ready = 0;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == STDIN_FILENO)
+                input_ready = 1;
+            else
+                events_dispatch(0);
+        }
+
+        if (finished_jobs > 0) {
+            printf("\r\033[K");
+            report_finished_jobs();
+            announced = 1;
+        }
+
+        if (input_ready)
+            return announced;
+    }
+}
+
+// Returns once no process of the job is running any more, i.e. it either
+// finished or was stopped.
+void wait_for_job(job_t* job) {
+    while (job->state_counts[JOB_RUNNING] > 0)
+        events_dispatch(-1);
+}
@@ -1,20 +1,42 @@
+#define _GNU_SOURCE
 #include "../headers/execute.h"
 
 #include "../headers/internalfuncs.h"
+#include "../headers/spawn.h"
+#include "../headers/events.h"
+#include "../headers/usage.h"
+#include "../headers/trace.h"
 
+#include <fnmatch.h>
 
-void duplicate_fd(command* cmd) {
+int last_status = 0;
+int exit_requested = 0;
+
+int loop_depth = 0;
+int loop_levels = 0;
+int loop_continue = 0;
+
+// The arena the running tree expands its words in; groups get back into
+// execute_node through an internal_func and find it here
+static arena* exec_arena = NULL;
+
+// Set in a forked group: its foreground jobs stay in its process group,
+// which is the one the terminal and Ctrl+C know about
+static int in_subshell = 0;
+
+int redirect_fds(command* cmd) {
     if (cmd->redirectInput != NULL) {
         int fd = open(cmd->redirectInput, O_RDONLY);
 
         if (fd < 0) {
             fprintf(stderr, "Could not open file");
-            exit(EXIT_FAILURE);
+            return -1;
         }
 
         if (dup2(fd, STDIN_FILENO) < 0) { 
             perror("dup2 stdin failed");
-            exit(EXIT_FAILURE);
+            close(fd);
+            return -1;
         }
         close(fd);
     }
@@ -31,218 +53,643 @@ void duplicate_fd(command* cmd) {
 
         if (fd < 0) {
             fprintf(stderr, "Could not open file");
-            exit(EXIT_FAILURE);
+            return -1;
         }
 
         if (dup2(fd, STDOUT_FILENO) < 0) {
             perror("dup2 stdout failed");
-            exit(EXIT_FAILURE);
+            close(fd);
+            return -1;
         }
         
         close(fd);
     }
+    return 0;
+}
+
+void duplicate_fd(command* cmd) {
+    if (redirect_fds(cmd) < 0)
+        exit(EXIT_FAILURE);
+}
+
+// A builtin run inside the shell can't be interrupted the way a child can,
+// so anything that would sit reading the terminal keeps its own process.
+static int reads_terminal(command* cmd, internal_func func) {
+    return func == internal_cat && cmd->argc < 2 && cmd->redirectInput == NULL;
+}
+
+static int can_run_in_process(const internal_pair* builtin) {
+    return builtin != NULL && !builtin->run_in_parent && !builtin->needs_own_process;
+}
+
+// { list } in the shell: the body runs right where the group stands
+static int run_group(const command* cmd) {
+    return execute_node(exec_arena, cmd->body);
+}
+
+// A group with a process of its own: ( list ), a group in the background
+// or a pipeline stage that can't run in the shell
+static int run_group_in_child(const command* cmd) {
+    shell_interactive = 0;
+    in_subshell = 1;
+    if (events_reinit_in_child() < 0)
+        return 1;
+    mark_tail(cmd->body);
+    return run_group(cmd);
+}
+
+// What runs a stage that isn't an external command
+static internal_func stage_func(command* cmd) {
+    if (cmd->body) return run_group_in_child;
+    const internal_pair* builtin = command_builtin(cmd);
+    return builtin ? builtin->fptr : NULL;
+}
+
+// A list made only of single builtins that can run inside the shell,
+// judged by the words as typed. Such a group never needs a process.
+// while/until loops are left out: one feeding a pipe that got closed
+// would spin in the shell instead of dying of SIGPIPE.
+static int builtin_only(const node* n) {
+    if (n == NULL)
+        return 1;
+    if (n->background || n->type == NODE_WHILE || n->type == NODE_UNTIL)
+        return 0;
+    if (n->type == NODE_CASE) {
+        for (size_t i = 0; i < n->itemc; ++i)
+            if (!builtin_only(n->items[i].body)) return 0;
+        return 1;
+    }
+    if (n->type != NODE_PIPELINE)
+        return builtin_only(n->left) && builtin_only(n->right) && builtin_only(n->alternative);
+
+    const pipeline* p = n->pipeline;
+    if (p->background || p->cmdc > 1)
+        return 0;
+    if (p->cmdc == 0)
+        return 1;
+
+    command* cmd = p->cmds[0];
+    if (cmd->body)
+        return !cmd->subshell && builtin_only(cmd->body);
+
+    if (cmd->builtin < 0) return 0;
+    const internal_pair* builtin = command_builtin(cmd);
+    if (!can_run_in_process(builtin))
+        return 0;
+    // a bare cat would read the terminal from inside the shell
+    return builtin->fptr != internal_cat || cmd->wordc > 1 || cmd->inputWord;
+}
+
+// Runs a builtin in the shell process, with in_fd/out_fd and the command's
+// redirections swapped onto stdin/stdout only for the duration of the call.
+static int run_builtin_in_process(command* cmd, internal_func func, int in_fd, int out_fd) {
+    int saved_in = -1, saved_out = -1;
+    int status = 1;
+
+    fflush(stdout);
+
+    if (in_fd >= 0 || cmd->redirectInput != NULL) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0 || cmd->redirectOutput != NULL) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    }
+
+    if (redirect_fds(cmd) == 0) {
+        uint64_t start = trace_now();
+        status = func(cmd);
+        fflush(stdout);
+        trace_record(TRACE_BUILTIN, start, cmd->argv[0]);
+    }
+    clearerr(stdout);
+
+    if (saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    if (saved_out >= 0) {
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    return status;
+}
+
+// At most one stage of a foreground pipeline runs inside the shell: every
+// other stage must already be running so the pipes around it keep
+// draining. The first builtin followed by an external stage (or sitting at
+// the end) is the one that saves a process. A group of builtins counts.
+static long pick_in_process_stage(pipeline* p, internal_func* out) {
+    if (p->background) return -1;
+
+    for (size_t i = 0; i < p->cmdc; ++i) {
+        command* cmd = p->cmds[i];
+        internal_func func;
+        if (cmd->body) {
+            if (cmd->subshell || !builtin_only(cmd->body)) continue;
+            func = run_group;
+        } else {
+            const internal_pair* builtin = command_builtin(cmd);
+            if (!can_run_in_process(builtin)) continue;
+            func = builtin->fptr;
+            if (i == 0 && reads_terminal(cmd, func)) continue;
+        }
+
+        if (i == p->cmdc - 1 || stage_func(p->cmds[i + 1]) == NULL) {
+            *out = func;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Puts freshly spawned processes under a job and starts watching them.
+// Background jobs get their id right away; foreground ones only if they
+// are stopped.
+static job_t* register_job(pipeline* p, pid_t pgid, const pid_t* pids, char* const* names, size_t count) {
+    job_t* job = p->background ? add_job(pgid, p->buffer, p)
+                               : add_foreground_job(pgid, p->buffer);
+    if (job == NULL) return NULL;
+
+    for (size_t i = 0; i < count; ++i) {
+        add_process_to_job(pgid, pids[i], names[i]);
+        events_watch_child(pids[i]);
+    }
+
+    if (p->background)
+        printf("[%d] PGID: %ld\n", job->job_id, (long)pgid);
+    return job;
+}
+
+// Called with the terminal already handed to the job. A job that stopped
+// is not timed: it gets reported when it is finished with fg instead.
+// Returns the job's exit status.
+static int finish_foreground_job(job_t* job, const usage_mark* mark) {
+    uint64_t start = trace_now();
+    wait_for_job(job);
+    trace_record(TRACE_WAIT, start, job->command_line);
+
+    reclaim_terminal();
+    fg_pgid = 0;
+
+    int status = job_exit_status(job);
+    // Ctrl+C went to the job, not to us: stop the rest of the line as well
+    if (status == 128 + SIGINT)
+        interrupted = 1;
+    if (job_is_stopped(job)) {
+        assign_job_id(job);
+        printf("\n[%d]+  Stopped\t%s\n", job->job_id, job->command_line);
+    } else {
+        if (mark) usage_print_report(mark, job);
+        delete_job(job);
+    }
+    return status;
+}
+
+// PIPE_CAPACITY is a size in bytes, optionally with a K or M suffix.
+// The kernel rounds it up to a power-of-two number of pages.
+static size_t pipe_capacity_of(const pipeline* p) {
+    const char* text = p->pipe_capacity ? p->pipe_capacity : get_var("PIPE_CAPACITY");
+    if (text == NULL || *text == '\0') return 0;
+
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        size <<= 10;
+        ++end;
+    } else if (*end == 'M' || *end == 'm') {
+        size <<= 20;
+        ++end;
+    }
+
+    if (*end != '\0' || size == 0 || size > INT_MAX) {
+        fprintf(stderr, "PIPE_CAPACITY: invalid size '%s'\n", text);
+        return 0;
+    }
+    return size;
 }
 
-void execute_pipeline(pipeline* curr_pipeline) {
-    int pipefds[2 * (curr_pipeline->cmdc - 1)];
+// PIPE_PACKET=1 makes every write() a packet that a read() never splits
+static int pipe_packet_mode(const pipeline* p) {
+    const char* text = p->pipe_packet ? p->pipe_packet : get_var("PIPE_PACKET");
+    return text != NULL && strcmp(text, "1") == 0;
+}
+
+static int open_pipe(int fds[2], size_t capacity, int packet) {
+    if (pipe2(fds, O_CLOEXEC | (packet ? O_DIRECT : 0)) < 0)
+        return -1;
+    // beyond /proc/sys/fs/pipe-max-size only root may go; keep the default
+    if (capacity && fcntl(fds[1], F_SETPIPE_SZ, (int)capacity) < 0)
+        fprintf(stderr, "PIPE_CAPACITY: %zu: %s\n", capacity, strerror(errno));
+    return 0;
+}
+
+int execute_pipeline(pipeline* curr_pipeline) {
+    size_t pipe_count = 2 * (curr_pipeline->cmdc - 1);
+    int pipefds[pipe_count];
     pid_t pids[curr_pipeline->cmdc];
+    char* names[curr_pipeline->cmdc];
+    size_t spawned = 0;
 
+    usage_mark timing, *mark = NULL;
+    if (curr_pipeline->timed && !curr_pipeline->background) {
+        usage_mark_now(&timing);
+        mark = &timing;
+    }
+
+    // Created close-on-exec: spawned stages keep only the ends dup'ed onto
+    // their stdin/stdout, without a close action per pipe in every child
+    uint64_t start = trace_now();
+    size_t capacity = pipe_capacity_of(curr_pipeline);
+    int packet = pipe_packet_mode(curr_pipeline);
     for (size_t i = 0; i < curr_pipeline->cmdc - 1; ++i) {
-        if (pipe(pipefds + i * 2) < 0) {
+        if (open_pipe(pipefds + i * 2, capacity, packet) < 0) {
             perror("pipe");
             exit(1);
         }
     }
+    trace_record(TRACE_PIPE_SETUP, start, NULL);
 
     int is_fg = (curr_pipeline->background == 0);
-    pid_t pg_leader = 0;
-
-    sigset_t mask, oldmask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    pid_t pg_leader = (in_subshell && is_fg) ? getpgrp() : 0;
+    internal_func in_process_func = NULL;
+    long in_process = pick_in_process_stage(curr_pipeline, &in_process_func);
+    int last_failed = 0;
+
+    // In tail position the shell itself becomes the last stage, and the
+    // others join its process group since nobody will be left to forward
+    // signals to them.
+    size_t last = curr_pipeline->cmdc - 1;
+    int tail_exec = curr_pipeline->exec_in_place && is_fg
+                    && stage_func(curr_pipeline->cmds[last]) == NULL;
+    if (tail_exec) {
+        in_process = -1;
+        pg_leader = getpgrp();
+    }
 
     for (size_t i = 0; i < curr_pipeline->cmdc; ++i) {
         command* cmd = curr_pipeline->cmds[i];
-
-        pid_t pid = fork();
+        if ((long)i == in_process) continue;
+        if (tail_exec && i == last) break;
+
+        spawn_attrs attrs = {
+            .pgid = pg_leader,
+            .in_fd = (i > 0) ? pipefds[(i - 1) * 2] : -1,
+            .out_fd = (i < curr_pipeline->cmdc - 1) ? pipefds[i * 2 + 1] : -1,
+            .close_fds = pipefds,
+            .close_count = pipe_count,
+            .sigmask = events_child_sigmask(),
+        };
+
+        internal_func func = stage_func(cmd);
+        start = trace_now();
+        pid_t pid = func ? spawn_builtin(cmd, func, &attrs) : spawn_external(cmd, &attrs);
+        trace_record(TRACE_SPAWN, start, cmd->argv[0]);
         if (pid < 0) {
-            perror("fork");
-            exit(1);
+            last_failed = (i == last);
+            continue;
         }
 
-        if (pid == 0) { // CHILD
-            sigprocmask(SIG_SETMASK, &oldmask, NULL);
-            
-            setup_child_signals_and_pgrp((i == 0) ? 0 : pg_leader, is_fg);
-
-            // Set up pipes
-            if (i > 0) dup2(pipefds[(i - 1) * 2], STDIN_FILENO);
-            if (i < curr_pipeline->cmdc - 1) dup2(pipefds[i * 2 + 1], STDOUT_FILENO);
-
-            for (size_t j = 0; j < 2 * (curr_pipeline->cmdc - 1); ++j)
-                close(pipefds[j]);
-
-            internal_func func = get_internal_func(cmd->argv[0]);
-            duplicate_fd(cmd);
-
-            if (func) {
-                func(cmd);
-                _exit(0);
-            } else {
-                execvp(cmd->argv[0], cmd->argv);
-                perror("execvp");
-                _exit(1);
-            }
-        } 
-        else { // PARENT
-            pids[i] = pid;
-            if (i == 0) {
-                setpgid(pid, pid);
-                pg_leader = pid;
-            } else {
-                setpgid(pid, pg_leader);
-            }
+        names[spawned] = cmd->argv[0];
+        pids[spawned++] = pid;
+        if (pg_leader == 0) {
+            setpgid(pid, pid);
+            pg_leader = pid;
+        } else {
+            setpgid(pid, pg_leader);
         }
     }
 
-    for (size_t i = 0; i < 2 * (curr_pipeline->cmdc - 1); ++i)
-        close(pipefds[i]);
+    if (tail_exec) {
+        dup2(pipefds[(last - 1) * 2], STDIN_FILENO);
+        exec_command(curr_pipeline->cmds[last]);
+        exit(127);
+    }
 
-    job_t* job = NULL;
-    if (!is_fg) {
-        job = add_job(pg_leader, curr_pipeline->buffer, curr_pipeline);
-        for (int i = 0; i < curr_pipeline->cmdc; ++i) {
-            add_process_to_job(pg_leader, pids[i]);
-        }
-        printf("[%d] PGID: %ld\n", job->job_id, (long)pg_leader);
+    // The shell keeps only the pipe ends its own stage uses
+    int stage_in = -1, stage_out = -1;
+    if (in_process >= 0) {
+        if (in_process > 0) stage_in = pipefds[(in_process - 1) * 2];
+        if (in_process < (long)curr_pipeline->cmdc - 1) stage_out = pipefds[in_process * 2 + 1];
+    }
+    for (size_t i = 0; i < pipe_count; ++i) {
+        if (pipefds[i] != stage_in && pipefds[i] != stage_out)
+            close(pipefds[i]);
     }
 
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    job_t* job = (spawned > 0) ? register_job(curr_pipeline, pg_leader, pids, names, spawned) : NULL;
+    int status = 0;
 
     if (is_fg) {
-        fg_pgid = pg_leader;
-        give_terminal_to(pg_leader);
-
-        int alive = curr_pipeline->cmdc;
-        while (alive > 0) {
-            int status = 0;
-            pid_t w = waitpid(-1, &status, WUNTRACED);
-            if (w < 0) {
-                if (errno == EINTR) continue;
-                if (errno == ECHILD) break;
-                perror("waitpid");
-                break;
-            }
-            if (w == 0) continue;
-
-            pid_t wpgid = get_pgid_of_process(w);
-            if (wpgid != pg_leader) continue; 
-
-            if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                alive--;
-            } else if (WIFSTOPPED(status)) {
-                if (!job) {
-                    job = add_job(pg_leader, curr_pipeline->buffer, curr_pipeline);
-                    for (int i = 0; i < curr_pipeline->cmdc; ++i) {
-                        add_process_to_job(pg_leader, pids[i]);
-                    }
-                    printf("\n[%d]+  Stopped\t%s\n", job->job_id, curr_pipeline->buffer);
-                }
-                update_job_status(job, w, JOB_STOPPED);
-                break;
-            }
+        if (job) {
+            fg_pgid = pg_leader;
+            give_terminal_to(pg_leader);
+        }
+
+        if (in_process >= 0) {
+            command* cmd = curr_pipeline->cmds[in_process];
+            status = run_builtin_in_process(cmd, in_process_func, stage_in, stage_out);
+            // closing our ends is what lets the neighbours see EOF/EPIPE
+            if (stage_in >= 0) close(stage_in);
+            if (stage_out >= 0) close(stage_out);
         }
 
-        reclaim_terminal();
-        fg_pgid = 0;
+        // the pipeline's status is its last stage's
+        if (job) {
+            int job_status = finish_foreground_job(job, mark);
+            if (in_process != (long)last) status = job_status;
+        } else if (mark) {
+            usage_print_report(mark, NULL);
+        }
+        if (last_failed) status = 127;
     }
+    return status;
 }
 
-void execute_single_command(pipeline* curr_pipeline) {
+int execute_single_command(pipeline* curr_pipeline) {
     command* cmd = curr_pipeline->cmds[0];
     
-    if (cmd->argc == 0) return;
+    if (cmd->argc == 0) return 0;
+
+    usage_mark timing, *mark = NULL;
+    if (curr_pipeline->timed && !curr_pipeline->background) {
+        usage_mark_now(&timing);
+        mark = &timing;
+    }
+
+    // { list } runs in the shell, its redirections swapped in around it
+    if (cmd->body && !cmd->subshell && curr_pipeline->background == 0) {
+        int status = run_builtin_in_process(cmd, run_group, -1, -1);
+        if (mark) usage_print_report(mark, NULL);
+        return status;
+    }
     
+    const internal_pair* builtin = cmd->body ? NULL : command_builtin(cmd);
+
     // Check if parent built-in
-    if (is_parent_builtin(cmd->argv[0])) {
-        internal_func func = get_internal_func(cmd->argv[0]);
-        if (func != NULL) {
-            func(cmd);
-            return;
+    if (builtin && builtin->run_in_parent) {
+        // 'hash > file': swap the redirections in around the call. exec
+        // applies its own, since without a command they must stay put.
+        if ((cmd->redirectInput || cmd->redirectOutput) && builtin->fptr != internal_exec) {
+            int status = run_builtin_in_process(cmd, builtin->fptr, -1, -1);
+            if (mark) usage_print_report(mark, NULL);
+            return status;
         }
+        uint64_t start = trace_now();
+        int status = builtin->fptr(cmd);
+        trace_record(TRACE_BUILTIN, start, cmd->argv[0]);
+        if (mark) usage_print_report(mark, NULL);
+        return status;
     }
     
-    sigset_t mask, oldmask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    internal_func func = cmd->body ? run_group_in_child : builtin ? builtin->fptr : NULL;
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork failed");
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-        return;
+    // Nothing runs after this command, so there is nothing to wait for
+    if (curr_pipeline->exec_in_place && curr_pipeline->background == 0 && func == NULL) {
+        exec_command(cmd);
+        exit(127);
     }
 
-    if (pid == 0) {
-        // CHILD
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-        
-        int is_fg = (curr_pipeline->background == 0);
-        setup_child_signals_and_pgrp(0, is_fg);
-        duplicate_fd(cmd);
-
-        internal_func func = get_internal_func(cmd->argv[0]);
-        if (func != NULL) {
-            func(cmd);
-            _exit(EXIT_SUCCESS);
-        }
-        execvp(cmd->argv[0], cmd->argv);
-        perror("execvp failed");
-        _exit(EXIT_FAILURE);
+    // Foreground builtins don't need a process of their own
+    if (curr_pipeline->background == 0 && !cmd->body && can_run_in_process(builtin)
+        && !reads_terminal(cmd, func)) {
+        int status = run_builtin_in_process(cmd, func, -1, -1);
+        if (mark) usage_print_report(mark, NULL);
+        return status;
+    }
+
+    spawn_attrs attrs = {
+        .pgid = (in_subshell && curr_pipeline->background == 0) ? getpgrp() : 0,
+        .in_fd = -1,
+        .out_fd = -1,
+        .close_fds = NULL,
+        .close_count = 0,
+        .sigmask = events_child_sigmask(),
+    };
+
+    // Only builtins that must run in a child pay for a fork
+    uint64_t start = trace_now();
+    pid_t pid = func ? spawn_builtin(cmd, func, &attrs) : spawn_external(cmd, &attrs);
+    trace_record(TRACE_SPAWN, start, cmd->argv[0]);
+    if (pid < 0)
+        return 127;
+
+    pid_t pgid = attrs.pgid ? attrs.pgid : pid;
+    setpgid(pid, pgid);
+
+    job_t* job = register_job(curr_pipeline, pgid, &pid, cmd->argv, 1);
+
+    if (job && curr_pipeline->background == 0) {
+        fg_pgid = pgid;
+        give_terminal_to(pgid);
+        return finish_foreground_job(job, mark);
+    }
+    return 0;
+}
+
+// Expands the pipeline's words just before it runs; whatever the
+// expansion allocated is dropped again once it is done
+static int run_pipeline(arena* a, pipeline* p) {
+    if (p->cmdc == 0) return last_status;
+
+    arena_mark mark = arena_save(a);
+    int status = 1;
+
+    size_t i = 0;
+    while (i < p->cmdc && expand_command(a, p->cmds[i]) == 0)
+        ++i;
+    if (i == p->cmdc)
+        status = (p->cmdc == 1) ? execute_single_command(p) : execute_pipeline(p);
+
+    arena_restore(a, mark);
+    return status;
+}
+
+// Runs n as a single job in a forked copy of the shell
+static int run_forked(node* n, int background, char* text) {
+    node body = *n;
+    body.background = 0;
+
+    char* argv[] = { "(", NULL };
+    command group = command_default;
+    group.argc = 1;
+    group.argv = argv;
+    group.body = &body;
+    group.subshell = 1;
+
+    command* cmds[] = { &group };
+    pipeline p = pipeline_default;
+    p.cmdc = 1;
+    p.cmds = cmds;
+    p.background = background;
+    p.buffer = text;
+    return execute_single_command(&p);
+}
+
+int execute_subshell(arena* a, node* n) {
+    arena* saved = exec_arena;
+    exec_arena = a;
+    last_status = run_forked(n, 0, "(");
+    exec_arena = saved;
+    return last_status;
+}
+
+// exit, Ctrl+C or a pending break/continue: nothing more runs until the
+// loop or line they apply to is left
+static int stopping(void) {
+    return exit_requested || interrupted || loop_levels > 0;
+}
+
+// Called after each loop condition and body. A break or continue aimed at
+// an outer loop leaves this one with the count one lower.
+static int keep_looping(void) {
+    if (exit_requested || interrupted) return 0;
+    if (loop_levels == 0) return 1;
+
+    if (loop_levels == 1 && loop_continue) {
+        loop_levels = 0;
+        loop_continue = 0;
+        return 1;
+    }
+    if (--loop_levels == 0)
+        loop_continue = 0;
+    return 0;
+}
+
+static int run_if(arena* a, node* n) {
+    int cond = execute_node(a, n->left);
+    if (stopping())
+        return cond;
+    if (cond == 0)
+        return execute_node(a, n->right);
+    // no branch taken is success
+    return n->alternative ? execute_node(a, n->alternative) : 0;
+}
+
+static int run_while(arena* a, node* n) {
+    int status = 0;
+
+    ++loop_depth;
+    while (1) {
+        int cond = execute_node(a, n->left);
+        if (!keep_looping() || (cond == 0) != (n->type == NODE_WHILE))
+            break;
+        status = execute_node(a, n->right);
+        if (!keep_looping())
+            break;
+    }
+    --loop_depth;
+    return status;
+}
+
+// The list is expanded once, before the first pass
+static int run_for(arena* a, node* n) {
+    arena_mark mark = arena_save(a);
+    char** values = arena_alloc(a, (n->wordc + 1) * sizeof(char*));
+    int status = (values == NULL);
+
+    for (size_t i = 0; values && i < n->wordc; ++i) {
+        values[i] = expand_word(a, &n->words[i]);
+        if (values[i] == NULL) {
+            arena_restore(a, mark);
+            return 1;
+        }
+    }
+
+    ++loop_depth;
+    for (size_t i = 0; values && i < n->wordc; ++i) {
+        set_var(n->name, values[i]);
+        status = execute_node(a, n->right);
+        if (!keep_looping())
+            break;
+    }
+    --loop_depth;
+
+    arena_restore(a, mark);
+    return status;
+}
+
+// Patterns are matched with fnmatch; a pattern with any quoting in it
+// only matches the word exactly
+static int run_case(arena* a, node* n) {
+    arena_mark mark = arena_save(a);
+    int status = 0;
+
+    char* subject = expand_word(a, &n->words[0]);
+    if (subject == NULL) {
+        arena_restore(a, mark);
+        return 1;
+    }
+
+    for (size_t i = 0; i < n->itemc; ++i) {
+        case_item* item = &n->items[i];
+        int matched = 0;
+        for (size_t j = 0; j < item->patternc && !matched; ++j) {
+            char* pattern = expand_word(a, &item->patterns[j]);
+            if (pattern == NULL) continue;
+            matched = item->patterns[j].quoted ? strcmp(pattern, subject) == 0
+                                               : fnmatch(pattern, subject, 0) == 0;
+        }
+        if (matched) {
+            status = item->body ? execute_node(a, item->body) : 0;
+            break;
+        }
+    }
+
+    arena_restore(a, mark);
+    return status;
+}
+
+int execute_node(arena* a, node* n) {
+    arena* saved = exec_arena;
+    exec_arena = a;
+
+    int status;
+    if (n->background) {
+        // an and/or list or sequence followed by '&' is one job
+        status = run_forked(n, 1, n->text);
     } else {
-        // PARENT
-        setpgid(pid, pid);
-
-        job_t* job = NULL;
-        if (curr_pipeline->background != 0) {
-            job = add_job(pid, curr_pipeline->buffer, curr_pipeline);
-            add_process_to_job(pid, pid);
-            printf("[%d] PGID: %ld\n", job->job_id, (long)pid);
-        }
-
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-
-        if (curr_pipeline->background == 0) {
-            fg_pgid = pid;
-            give_terminal_to(pid);
-
-            int status;
-            while (1) {
-                pid_t w = waitpid(pid, &status, WUNTRACED);
-                if (w < 0) {
-                    if (errno == EINTR) continue;
-                    perror("waitpid");
-                    break;
-                }
-                if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                    // done
-                    break;
-                }
-                if (WIFSTOPPED(status)) {
-                    if (!job) {
-                        job = add_job(pid, curr_pipeline->buffer, curr_pipeline);
-                        add_process_to_job(pid, pid);
-                        printf("\n[%d]+  Stopped\t%s\n", job->job_id, curr_pipeline->buffer);
-                    }
-                    update_job_status(job, pid, JOB_STOPPED);
-                    break;
-                }
+        switch (n->type) {
+            case NODE_PIPELINE:
+                status = run_pipeline(a, n->pipeline);
+                break;
+            case NODE_IF:
+                status = run_if(a, n);
+                break;
+            case NODE_WHILE:
+            case NODE_UNTIL:
+                status = run_while(a, n);
+                break;
+            case NODE_FOR:
+                status = run_for(a, n);
+                break;
+            case NODE_CASE:
+                status = run_case(a, n);
+                break;
+            default: {
+                status = execute_node(a, n->left);
+                int run_right = (n->type == NODE_SEQUENCE)
+                                || (n->type == NODE_AND && status == 0)
+                                || (n->type == NODE_OR && status != 0);
+                if (run_right && !stopping())
+                    status = execute_node(a, n->right);
             }
-
-            reclaim_terminal();
-            fg_pgid = 0;
         }
     }
+
+    exec_arena = saved;
+    last_status = status;
+    return status;
+}
+
+void mark_tail(node* n) {
+    // only lists: the last command of a loop or an if isn't the last to run
+    while (n->type == NODE_SEQUENCE || n->type == NODE_AND || n->type == NODE_OR) {
+        if (n->background) return;
+        n = n->right;
+    }
+    if (n->type != NODE_PIPELINE || n->background) return;
+    // a timed command has to come back to the shell to be reported
+    n->pipeline->exec_in_place = !n->pipeline->timed;
 }
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+
+#include "../headers/fastcopy.h"
+#include "../headers/parser.h"
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define COPY_DONE        0
+#define COPY_FAILED     -1
+#define COPY_UNSUPPORTED 1
+
+#define SPLICE_CHUNK (1 << 20)
+#define KERNEL_CHUNK (1 << 30)
+
+// errno values meaning "this kernel path doesn't handle this fd pair",
+// as opposed to a real I/O error
+static int is_unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP
+        || err == EBADF || err == ESPIPE;
+}
+
+// Ctrl+C while cat runs inside the shell: give up as a killed child would.
+// Checked on every chunk, since /dev/zero to /dev/null never blocks.
+static int stop_requested(void) {
+    if (!interrupted) return 0;
+    errno = EINTR;
+    return 1;
+}
+
+static int copy_with_splice(int in_fd, int out_fd) {
+    while (!stop_requested()) {
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) return COPY_DONE;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return is_unsupported(errno) ? COPY_UNSUPPORTED : COPY_FAILED;
+        }
+    }
+    return COPY_FAILED;
+}
+
+static int copy_with_range(int in_fd, int out_fd) {
+    while (!stop_requested()) {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, KERNEL_CHUNK, 0);
+        if (n == 0) return COPY_DONE;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return is_unsupported(errno) ? COPY_UNSUPPORTED : COPY_FAILED;
+        }
+    }
+    return COPY_FAILED;
+}
+
+static int copy_with_sendfile(int in_fd, int out_fd) {
+    while (!stop_requested()) {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, KERNEL_CHUNK);
+        if (n == 0) return COPY_DONE;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return is_unsupported(errno) ? COPY_UNSUPPORTED : COPY_FAILED;
+        }
+    }
+    return COPY_FAILED;
+}
+
+static int copy_with_buffer(int in_fd, int out_fd) {
+    static char* buffer = NULL;
+    if (buffer == NULL) {
+        buffer = malloc(COPY_BUFFER_SIZE);
+        if (buffer == NULL) return COPY_FAILED;
+    }
+
+    while (!stop_requested()) {
+        ssize_t n = read(in_fd, buffer, COPY_BUFFER_SIZE);
+        if (n == 0) return COPY_DONE;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return COPY_FAILED;
+        }
+
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(out_fd, buffer + done, n - done);
+            if (w < 0) {
+                if (errno == EINTR && !stop_requested()) continue;
+                return COPY_FAILED;
+            }
+            done += w;
+        }
+    }
+    return COPY_FAILED;
+}
+
+// Streams in_fd to out_fd through the cheapest path the kernel offers for
+// this pair of fds. Every path works on the fd offsets, so falling back
+// after a partial transfer simply carries on where the last one stopped.
+// Returns 0 on success, -1 with errno set on an I/O error, or with EINTR
+// once interrupted is set.
+int copy_fd(int in_fd, int out_fd) {
+    struct stat in_st, out_st;
+    if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0)
+        return -1;
+
+    int r = COPY_UNSUPPORTED;
+
+    if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+        r = copy_with_splice(in_fd, out_fd);
+
+    if (r == COPY_UNSUPPORTED && S_ISREG(in_st.st_mode)) {
+        if (S_ISREG(out_st.st_mode))
+            r = copy_with_range(in_fd, out_fd);
+        // sendfile covers file -> socket, and file -> file across filesystems
+        if (r == COPY_UNSUPPORTED)
+            r = copy_with_sendfile(in_fd, out_fd);
+    }
+
+    if (r == COPY_UNSUPPORTED)
+        r = copy_with_buffer(in_fd, out_fd);
+
+    return (r == COPY_DONE) ? 0 : -1;
+}
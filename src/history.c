@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+
+#include "../headers/history.h"
+#include "../headers/variables.h"
+#include "../headers/hash.h"
+#include "../headers/table.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Recent lines for Up/Down, oldest at ring_start
+static char* ring[HISTORY_MAX];
+static int ring_start = 0;
+static int ring_len = 0;
+static uint64_t last_hash = 0;
+
+// The history file as it was at startup, and where new lines go
+static const char* file_map = NULL;
+static size_t file_len = 0;
+static int append_fd = -1;
+
+// Lines are ordered by sequence number: the file's lines count up from 0
+// as the index reads them, this session's from SESSION_SEQ_BASE.
+#define SESSION_SEQ_BASE (1L << 40)
+static long session_lines = 0;
+
+// Reverse search works on distinct lines. Each remembers the last time
+// it was run, so a search never shows the same line twice.
+typedef struct {
+    const char* text;   // view into file_map, or owned for lines added later
+    uint32_t len;
+    long last_seq;
+} hist_unique;
+
+static hist_unique* uniques = NULL;
+static size_t unique_count = 0, unique_cap = 0;
+
+// A line's hash -> its index in uniques
+typedef struct {
+    uint64_t hash;
+    uint32_t id;
+} unique_slot;
+
+static hash_table unique_index = TABLE_INIT(unique_slot);
+
+// Trigram -> ascending list of unique ids whose text contains it
+typedef struct {
+    uint64_t key;       // three bytes, plus 1 << 24 so it is never 0
+    uint32_t count;
+    uint32_t cap;
+    uint32_t* ids;
+} posting;
+
+static hash_table postings = TABLE_INIT(posting);
+static int index_built = 0;
+
+static void ring_push(char* line) {
+    if (ring_len < HISTORY_MAX) {
+        ring[(ring_start + ring_len++) % HISTORY_MAX] = line;
+    } else {
+        free(ring[ring_start]);
+        ring[ring_start] = line;
+        ring_start = (ring_start + 1) % HISTORY_MAX;
+    }
+}
+
+int history_count(void) {
+    return ring_len;
+}
+
+const char* history_get(int i) {
+    if (i < 0 || i >= ring_len) return NULL;
+    return ring[(ring_start + i) % HISTORY_MAX];
+}
+
+static uint64_t trigram_key(const char* s) {
+    return (1u << 24) | ((unsigned char)s[0] << 16) | ((unsigned char)s[1] << 8) | (unsigned char)s[2];
+}
+
+static void index_trigrams(uint32_t id, const char* text, size_t len) {
+    for (size_t i = 0; i + 3 <= len; ++i) {
+        posting* p = table_insert(&postings, trigram_key(text + i), NULL, NULL);
+        if (p == NULL) return;
+        // ids arrive in increasing order, so a repeat is always the last one
+        if (p->count && p->ids[p->count - 1] == id) continue;
+
+        if (p->count == p->cap) {
+            uint32_t new_cap = p->cap ? p->cap * 2 : 4;
+            uint32_t* grown = realloc(p->ids, new_cap * sizeof(uint32_t));
+            if (grown == NULL) return;
+            p->ids = grown;
+            p->cap = new_cap;
+        }
+        p->ids[p->count++] = id;
+    }
+}
+
+typedef struct {
+    const char* text;
+    size_t len;
+} line_key;
+
+static int same_line(const void* entry, const void* key) {
+    const hist_unique* u = &uniques[((const unique_slot*)entry)->id];
+    const line_key* k = key;
+    return u->len == k->len && memcmp(u->text, k->text, k->len) == 0;
+}
+
+// Notes that text was run as line seq; owned says text must be copied
+static void index_line(const char* text, size_t len, uint64_t hash, long seq, int owned) {
+    line_key key = { text, len };
+    unique_slot* slot = table_find(&unique_index, hash, same_line, &key);
+    if (slot) {
+        uniques[slot->id].last_seq = seq;
+        return;
+    }
+
+    if (unique_count == unique_cap) {
+        size_t new_cap = unique_cap ? unique_cap * 2 : 512;
+        hist_unique* grown = realloc(uniques, new_cap * sizeof(hist_unique));
+        if (grown == NULL) {
+            perror("allocation failed");
+            return;
+        }
+        uniques = grown;
+        unique_cap = new_cap;
+    }
+
+    slot = table_insert(&unique_index, hash, same_line, &key);
+    if (slot == NULL) return;
+
+    hist_unique* u = &uniques[unique_count];
+    u->text = owned ? strndup(text, len) : text;
+    u->len = len;
+    u->last_seq = seq;
+    slot->id = unique_count;
+    index_trigrams(unique_count, text, len);
+    ++unique_count;
+}
+
+// Built on the first Ctrl+R, so startup never pays for it
+static void build_index(void) {
+    index_built = 1;
+
+    long seq = 0;
+    const char* p = file_map;
+    const char* end = file_map + file_len;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl : end;
+        if (line_end > p)
+            index_line(p, line_end - p, fnv1a(FNV1A_SEED, p, line_end - p), seq++, 0);
+        p = line_end + 1;
+    }
+
+    // lines added this session before the first search, still in the ring
+    long in_ring = session_lines < ring_len ? session_lines : ring_len;
+    for (long i = 0; i < in_ring; ++i) {
+        const char* text = history_get(ring_len - in_ring + i);
+        index_line(text, strlen(text), fnv1a(FNV1A_SEED, text, strlen(text)),
+                   SESSION_SEQ_BASE + session_lines - in_ring + i, 1);
+    }
+}
+
+void add_history(const char *cmd) {
+    size_t len = strlen(cmd);
+    if (len == 0) return;
+
+    uint64_t hash = fnv1a(FNV1A_SEED, cmd, len);
+    const char* prev = ring_len ? history_get(ring_len - 1) : NULL;
+    if (prev && hash == last_hash && strcmp(prev, cmd) == 0)
+        return;
+    last_hash = hash;
+
+    char* copy = strdup(cmd);
+    if (copy == NULL) return;
+    ring_push(copy);
+
+    if (append_fd >= 0) {
+        struct iovec iov[2] = { { (void*)cmd, len }, { "\n", 1 } };
+        if (writev(append_fd, iov, 2) < 0) {
+            close(append_fd);
+            append_fd = -1;
+        }
+    }
+
+    if (index_built)
+        index_line(cmd, len, hash, SESSION_SEQ_BASE + session_lines, 1);
+    ++session_lines;
+}
+
+void history_init(void) {
+    char path[PATH_MAX];
+    const char* histfile = get_var("HISTFILE");
+    if (histfile && *histfile) {
+        snprintf(path, sizeof(path), "%s", histfile);
+    } else {
+        const char* home = get_var("HOME");
+        if (home == NULL) return;
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+    }
+
+    append_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            file_map = map;
+            file_len = st.st_size;
+        }
+    }
+    close(fd);
+    if (file_map == NULL) return;
+
+    // Only the tail is needed up front: walk back HISTORY_MAX lines
+    const char* end = file_map + file_len;
+    const char* p = end;
+    if (p > file_map && p[-1] == '\n') --p;
+    for (int lines = 0; p > file_map && lines < HISTORY_MAX; ++lines) {
+        const char* nl = memrchr(file_map, '\n', p - file_map);
+        p = nl ? nl : file_map;
+    }
+    if (p > file_map) ++p;
+
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl : end;
+        if (line_end > p) {
+            uint64_t hash = fnv1a(FNV1A_SEED, p, line_end - p);
+            const char* prev = ring_len ? history_get(ring_len - 1) : NULL;
+            size_t len = line_end - p;
+            if (!(prev && hash == last_hash && strlen(prev) == len && memcmp(prev, p, len) == 0)) {
+                last_hash = hash;
+                ring_push(strndup(p, len));
+            }
+        }
+        p = line_end + 1;
+    }
+}
+
+static const char* result_copy(const hist_unique* u) {
+    static char* buf = NULL;
+    static size_t cap = 0;
+    if (u->len + 1 > cap) {
+        char* grown = realloc(buf, u->len + 1);
+        if (grown == NULL) return NULL;
+        buf = grown;
+        cap = u->len + 1;
+    }
+    memcpy(buf, u->text, u->len);
+    buf[u->len] = '\0';
+    return buf;
+}
+
+const char* history_search(const char* needle, long* cursor) {
+    if (!index_built) build_index();
+
+    size_t nlen = strlen(needle);
+    long bound = (*cursor < 0) ? LONG_MAX : *cursor;
+    const hist_unique* best = NULL;
+
+    if (nlen < 3) {
+        for (size_t u = 0; u < unique_count; ++u) {
+            const hist_unique* h = &uniques[u];
+            if (h->last_seq < bound && (!best || h->last_seq > best->last_seq)
+                && memmem(h->text, h->len, needle, nlen))
+                best = h;
+        }
+    } else {
+        // Every match contains all of needle's trigrams: scan the rarest
+        const posting* rarest = NULL;
+        for (size_t i = 0; i + 3 <= nlen; ++i) {
+            const posting* p = table_find(&postings, trigram_key(needle + i), NULL, NULL);
+            if (p == NULL) return NULL;
+            if (!rarest || p->count < rarest->count) rarest = p;
+        }
+
+        for (uint32_t i = 0; i < rarest->count; ++i) {
+            const hist_unique* h = &uniques[rarest->ids[i]];
+            if (h->last_seq < bound && (!best || h->last_seq > best->last_seq)
+                && memmem(h->text, h->len, needle, nlen))
+                best = h;
+        }
+    }
+
+    if (best == NULL) return NULL;
+    *cursor = best->last_seq;
+    return result_copy(best);
+}
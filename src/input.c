@@ -1,7 +1,11 @@
 #include "../headers/input.h"
+#include "../headers/events.h"
+#include "../headers/complete.h"
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-char *history[HISTORY_MAX];
-int history_len = 0;
 int history_index = 0;
 
 void disable_raw_mode() {
@@ -18,17 +22,103 @@ void enable_raw_mode() {
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
 }
 
+// Keystrokes are read in batches: a paste arrives in one read() and is
+// decoded from key_buf without going back to the kernel.
+static unsigned char key_buf[INPUT_BUF];
+static size_t key_len = 0, key_pos = 0;
+
+// Everything drawn between two reads goes out in one write()
+static char frame[FRAME_BUF];
+static size_t frame_len = 0;
+
+// The prompt, rebuilt only after the working directory changes
+static char prompt[PATH_MAX + 16];
+static size_t prompt_len = 0;
+static int continuation = 0;
+
+static void frame_flush(void) {
+    fflush(stdout); // job reports printed with stdio come first
+    size_t done = 0;
+    while (done < frame_len) {
+        ssize_t n = write(STDOUT_FILENO, frame + done, frame_len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    frame_len = 0;
+}
+
+static void frame_append(const char* s, size_t len) {
+    while (len > 0) {
+        if (frame_len == FRAME_BUF) frame_flush();
+        size_t n = FRAME_BUF - frame_len < len ? FRAME_BUF - frame_len : len;
+        memcpy(frame + frame_len, s, n);
+        frame_len += n;
+        s += n;
+        len -= n;
+    }
+}
+
+static void frame_puts(const char* s) {
+    frame_append(s, strlen(s));
+}
+
+void prompt_invalidate_cwd(void) {
+    prompt_len = 0;
+}
+
+void prompt_set_continuation(int on) {
+    continuation = on;
+}
+
+static void frame_prompt(void) {
+    if (continuation) {
+        frame_puts("> ");
+        return;
+    }
+    if (prompt_len == 0) {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+        prompt_len = snprintf(prompt, sizeof(prompt), "shell:~%s$ ", cwd);
+        if (prompt_len >= sizeof(prompt)) prompt_len = sizeof(prompt) - 1;
+    }
+    frame_append(prompt, prompt_len);
+}
+
+int input_pending(void) {
+    return key_pos < key_len;
+}
+
+// Next byte of input; reads (after showing the current frame) only when
+// the batch is used up. Returns -1 on EOF or error.
+static int next_byte(void) {
+    if (key_pos == key_len) {
+        frame_flush();
+        ssize_t n;
+        do {
+            n = read(STDIN_FILENO, key_buf, sizeof(key_buf));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        key_len = n;
+        key_pos = 0;
+    }
+    return key_buf[key_pos++];
+}
+
 int read_key() {
-    char c;
-    if (read(STDIN_FILENO, &c, 1) != 1) return -1;
+    int c = next_byte();
+    if (c < 0) return -1;
 
     if (c == '\x1b') { // ESC sequence
-        char seq[2];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        int seq0 = next_byte();
+        if (seq0 < 0) return '\x1b';
+        int seq1 = next_byte();
+        if (seq1 < 0) return '\x1b';
 
-        if (seq[0] == '[') {
-            switch (seq[1]) {
+        if (seq0 == '[') {
+            switch (seq1) {
                 case 'A': return ARROW_UP;
                 case 'B': return ARROW_DOWN;
                 case 'C': return ARROW_RIGHT;
@@ -40,87 +130,408 @@ int read_key() {
     return c;
 }
 
-void add_history(const char *cmd) {
-    if (history_len < HISTORY_MAX) {
-        history[history_len++] = strdup(cmd);
-    } else {
-        free(history[0]);
-        for (int i = 1; i < HISTORY_MAX; i++)
-            history[i-1] = history[i];
-        history[HISTORY_MAX-1] = strdup(cmd);
+void redraw_prompt(const char *buf) {
+    // Move cursor to start of line and clear it
+    frame_puts("\r\033[K");
+    frame_prompt();
+    // Print whatever is in the input buffer
+    frame_puts(buf);
+}
+
+// History lines from the file may be longer than the line editor allows
+static void copy_entry(char* buf, const char* entry) {
+    strncpy(buf, entry, INPUT_BUF - 1);
+    buf[INPUT_BUF - 1] = '\0';
+}
+
+static void draw_search(const char* query, const char* match) {
+    frame_puts("\r\033[K(reverse-i-search)`");
+    frame_puts(query);
+    frame_puts("': ");
+    if (match) frame_puts(match);
+}
+
+// Ctrl+R: incremental search back through the whole history. Returns the
+// key that ended it; buf holds the match unless the search was cancelled.
+static int reverse_search(char* buf) {
+    char query[INPUT_BUF] = "";
+    size_t qlen = 0;
+    long cursor = -1;
+    const char* match = NULL;
+    char saved[INPUT_BUF];
+    strcpy(saved, buf);
+
+    draw_search(query, NULL);
+    while (1) {
+        int key = read_key();
+
+        if (key == 18) {                        // Ctrl+R: next older match
+            if (qlen == 0) continue;
+            long older = cursor;
+            const char* found = history_search(query, &older);
+            if (found) {
+                match = found;
+                cursor = older;
+            }
+        } else if (key == 127) {                // Backspace: search again from the top
+            if (qlen == 0) continue;
+            query[--qlen] = '\0';
+            cursor = -1;
+            match = qlen ? history_search(query, &cursor) : NULL;
+        } else if (key >= 32 && key <= 126) {
+            if (qlen >= INPUT_BUF - 1) continue;
+            query[qlen++] = key;
+            query[qlen] = '\0';
+            // a longer query may still match the line already shown
+            long from = (match && strstr(match, query)) ? cursor + 1 : cursor;
+            const char* found = history_search(query, &from);
+            match = found;
+            cursor = found ? from : cursor;
+        } else if (key == 7 || key == '\x1b' || key < 0) {   // Ctrl+G / Esc: give up
+            strcpy(buf, saved);
+            return key;
+        } else {                                // anything else accepts the match
+            if (match)
+                copy_entry(buf, match);
+            return key;
+        }
+        draw_search(query, match);
     }
 }
 
+// Characters the lexer would split or expand on, escaped when inserted
+static int needs_escape(char c) {
+    return strchr(" \t\\'\"|&;<>()$`*?[]#~", c) != NULL;
+}
 
-void redraw_prompt(const char *buf) {
-    // Move cursor to start of line and clear it
-    printf("\r\033[K");
+static void insert_text(char* buf, int* pos, const char* s, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (*pos >= INPUT_BUF - 2) break;
+        if (needs_escape(s[i])) buf[(*pos)++] = '\\';
+        buf[(*pos)++] = s[i];
+    }
+    buf[*pos] = '\0';
+}
 
-    // Print your custom prompt
-    printf("shell:~");
-    internal_pwd(&command_default); // prints current working dir
-    printf("$ ");
+// Candidates in columns under the line, then the prompt again
+static void list_matches(const completion* c, const char* buf) {
+    size_t width = 0;
+    for (size_t i = 0; i < c->count; ++i) {
+        size_t len = strlen(c->matches[i]);
+        if (len > width) width = len;
+    }
+    width += 2;
 
-    // Print whatever is in the input buffer
-    printf("%s", buf);
+    struct winsize ws;
+    size_t cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) cols = ws.ws_col;
+    size_t per_row = cols / width ? cols / width : 1;
 
-    fflush(stdout); // Make sure it appears immediately
+    size_t shown = c->count < COMPLETE_LIST_MAX ? c->count : COMPLETE_LIST_MAX;
+    size_t rows = (shown + per_row - 1) / per_row;
+
+    frame_puts("\n");
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t col = 0; col < per_row; ++col) {
+            size_t i = col * rows + r;
+            if (i >= shown) break;
+            const char* name = c->matches[i];
+            frame_puts(name);
+            if (col + 1 < per_row && i + rows < shown)
+                for (size_t pad = strlen(name); pad < width; ++pad) frame_append(" ", 1);
+        }
+        frame_puts("\n");
+    }
+    if (shown < c->count) {
+        char more[64];
+        snprintf(more, sizeof(more), "... and %zu more\n", c->count - shown);
+        frame_puts(more);
+    }
+    redraw_prompt(buf);
+}
+
+// Tab: extends the word before the cursor as far as all candidates agree,
+// or lists them when it can't. The first word of a command is looked up
+// as a command, everything else as a file.
+static void complete_word(char* buf, int* pos) {
+    int start = *pos;
+    while (start > 0 && !(buf[start - 1] == ' ' && (start < 2 || buf[start - 2] != '\\')))
+        --start;
+
+    int before = start;
+    while (before > 0 && buf[before - 1] == ' ') --before;
+    int command_position = before == 0 || strchr("|&;(", buf[before - 1]) != NULL;
+
+    // the word as the lexer will see it, escapes removed
+    char word[INPUT_BUF];
+    size_t wlen = 0;
+    for (int i = start; i < *pos; ++i) {
+        if (buf[i] == '\\' && i + 1 < *pos) ++i;
+        word[wlen++] = buf[i];
+    }
+    word[wlen] = '\0';
+
+    completion c;
+    if (command_position && strchr(word, '/') == NULL)
+        complete_command(word, &c);
+    else
+        complete_filename(word, &c);
+
+    if (c.count == 0) {
+        frame_puts("\a");
+        return;
+    }
+
+    // sorted, so the first and last candidates bound the common prefix
+    const char* first = c.matches[0];
+    const char* last = c.matches[c.count - 1];
+    size_t common = 0;
+    while (first[common] && first[common] == last[common]) ++common;
+
+    if (c.count > 1 && common == c.base_len) {
+        list_matches(&c, buf);
+        return;
+    }
+
+    insert_text(buf, pos, first + c.base_len, common - c.base_len);
+    // a unique file or command is finished; a directory may go deeper
+    if (c.count == 1 && first[common - 1] != '/' && *pos < INPUT_BUF - 1) {
+        buf[(*pos)++] = ' ';
+        buf[*pos] = '\0';
+    }
+    redraw_prompt(buf);
 }
 
 void read_line(char *buf) {
     int pos = 0;
     buf[0] = '\0';
-    history_index = history_len; // start at "new line" position
+    history_index = history_count(); // start at "new line" position
 
-    printf("shell:~"); // 
-    internal_pwd(&command_default); // 
-    printf("$ "); // 
-    fflush(stdout);
+    frame_prompt();
 
     while (1) {
+        // jobs that finish while we sit at the prompt are announced at once
+        if (!input_pending()) {
+            frame_flush();
+            if (events_wait_for_input())
+                redraw_prompt(buf);
+        }
+
         int key = read_key();
 
+        if (key == 18) { // Ctrl+R
+            key = reverse_search(buf);
+            pos = strlen(buf);
+            redraw_prompt(buf);
+            if (key != '\n') continue;
+        }
+
         if (key == '\n') { // Enter
             buf[pos] = '\0';
-            printf("\n");
+            frame_puts("\n");
+            frame_flush();
             return;
         } 
         else if (key == 127) { // Backspace
             if (pos > 0) {
                 pos--;
                 buf[pos] = '\0';
-                printf("\b \b"); // move back, print space, move back again
-                fflush(stdout);
+                frame_puts("\b \b"); // move back, print space, move back again
             }
         }
         else if (key == ARROW_UP) {
             if (history_index > 0) {
                 history_index--;
-                strcpy(buf, history[history_index]);
+                copy_entry(buf, history_get(history_index));
                 pos = strlen(buf);
                 redraw_prompt(buf); // clear line & print
-                fflush(stdout);
             }
         }
         else if (key == ARROW_DOWN) {
-            if (history_index < history_len) {
+            if (history_index < history_count()) {
                 history_index++;
-                if (history_index == history_len)
+                if (history_index == history_count())
                     buf[0] = '\0';
                 else
-                    strcpy(buf, history[history_index]);
+                    copy_entry(buf, history_get(history_index));
                 pos = strlen(buf);
                 redraw_prompt(buf);
-                fflush(stdout);
             }
         }
+        else if (key == '\t') {
+            complete_word(buf, &pos);
+        }
         else if (key >= 32 && key <= 126) { // printable characters
             if (pos < INPUT_BUF - 1) {
                 buf[pos++] = key;
                 buf[pos] = '\0';
-                printf("%c", key);
-                fflush(stdout);
+                char c = key;
+                frame_append(&c, 1);
             }
         }
     }
+}
+
+int reader_open_file(line_reader* r, const char* path) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "shell: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+
+    // Pipes, fifos and the like can't be mapped; stream them instead
+    if (!S_ISREG(st.st_mode)) {
+        reader_open_fd(r, fd);
+        return 0;
+    }
+
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        r->data = map;
+        r->len = st.st_size;
+        r->mapped = 1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+void reader_open_fd(line_reader* r, int fd) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+}
+
+void reader_open_stdin(line_reader* r, int fd) {
+    reader_open_fd(r, fd);
+    r->shared = 1;
+    // a pipe can't be rewound, so read it a byte at a time like sh does
+    r->bytewise = lseek(fd, 0, SEEK_CUR) < 0;
+}
+
+void reader_open_string(line_reader* r, const char* text) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data = strdup(text);
+    r->len = strlen(text);
+}
+
+static char* copy_line(line_reader* r, const char* start, size_t len) {
+    if (len + 1 > r->line_cap) {
+        size_t new_cap = r->line_cap ? r->line_cap : INPUT_BUF;
+        while (new_cap < len + 1) new_cap *= 2;
+
+        char* grown = realloc(r->line, new_cap);
+        if (grown == NULL) {
+            perror("allocation failed");
+            return NULL;
+        }
+        r->line = grown;
+        r->line_cap = new_cap;
+    }
+
+    memcpy(r->line, start, len);
+    r->line[len] = '\0';
+    return r->line;
+}
+
+// Pulls the next chunk from the fd, keeping the unread tail in front
+static ssize_t refill(line_reader* r) {
+    if (r->pos > 0) {
+        memmove(r->data, r->data + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+
+    if (r->len == r->cap) {
+        size_t new_cap = r->cap ? r->cap * 2 : READER_CHUNK;
+        char* grown = realloc(r->data, new_cap);
+        if (grown == NULL) {
+            perror("allocation failed");
+            return -1;
+        }
+        r->data = grown;
+        r->cap = new_cap;
+    }
+
+    size_t want = r->cap - r->len;
+    if (r->bytewise)
+        want = 1;
+    else if (r->shared && want > READER_SHARED_CHUNK)
+        want = READER_SHARED_CHUNK;   // reader_sync re-reads what's left over
+
+    ssize_t n;
+    do {
+        n = read(r->fd, r->data + r->len, want);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) r->len += n;
+    return n;
+}
+
+char* reader_next_line(line_reader* r) {
+    while (1) {
+        char* start = r->data + r->pos;
+        size_t avail = r->len - r->pos;
+        char* nl = avail ? memchr(start, '\n', avail) : NULL;
+
+        if (nl) {
+            r->pos += (nl - start) + 1;
+            return copy_line(r, start, nl - start);
+        }
+
+        if (r->fd < 0 || refill(r) <= 0) {
+            // last line without a trailing newline
+            if (r->pos == r->len) return NULL;
+            start = r->data + r->pos;
+            avail = r->len - r->pos;
+            r->pos = r->len;
+            return copy_line(r, start, avail);
+        }
+    }
+}
+
+// Only whole-input sources (scripts, -c strings) can tell for sure;
+// a stream might still deliver more lines.
+int reader_at_end(const line_reader* r) {
+    if (r->fd >= 0) return 0;
+
+    for (size_t i = r->pos; i < r->len; ++i) {
+        char c = r->data[i];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            return 0;
+    }
+    return 1;
+}
+
+void reader_sync(line_reader* r) {
+    if (!r->shared || r->pos == r->len) return;
+
+    if (lseek(r->fd, -(off_t)(r->len - r->pos), SEEK_CUR) >= 0)
+        r->len = r->pos = 0;
+}
+
+void reader_close(line_reader* r) {
+    if (r->mapped)
+        munmap(r->data, r->len);
+    else
+        free(r->data);
+    free(r->line);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
 }
\ No newline at end of file
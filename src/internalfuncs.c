@@ -1,22 +1,49 @@
 #include "../headers/internalfuncs.h"
-
-internal_func get_internal_func(char* cmd) {
+#include "../headers/pathcache.h"
+#include "../headers/fastcopy.h"
+#include "../headers/execute.h"
+#include "../headers/spawn.h"
+#include "../headers/events.h"
+#include "../headers/trace.h"
+#include "../headers/input.h"
+
+// Every command looks itself up several times on its way to running, so
+// the first letter screens out most entries before a strcmp
+static const internal_pair* find_internal(const char* cmd) {
     for (int i = 0; internals[i].name != NULL; ++i) {
-        if (strcmp(cmd, internals[i].name) == 0)
-            return internals[i].fptr;
+        if (cmd[0] == internals[i].name[0] && strcmp(cmd, internals[i].name) == 0)
+            return &internals[i];
     }
     return NULL;
 }
 
+int resolve_builtin(const char* name) {
+    const internal_pair* entry = find_internal(name);
+    return entry ? (int)(entry - internals) : BUILTIN_NONE;
+}
+
+const internal_pair* command_builtin(const command* cmd) {
+    if (cmd->builtin == BUILTIN_UNRESOLVED)
+        return (cmd->argc > 0) ? find_internal(cmd->argv[0]) : NULL;
+    return (cmd->builtin >= 0) ? &internals[cmd->builtin] : NULL;
+}
+
+internal_func get_internal_func(char* cmd) {
+    const internal_pair* entry = find_internal(cmd);
+    return entry ? entry->fptr : NULL;
+}
+
 int is_parent_builtin(char* cmd) {
-    for (int i = 0; internals[i].name != NULL; ++i) {
-        if (strcmp(cmd, internals[i].name) == 0)
-            return internals[i].run_in_parent;
-    }
-    return 0;
+    const internal_pair* entry = find_internal(cmd);
+    return entry ? entry->run_in_parent : 0;
 }
 
-void internal_echo(const command* cmd) {
+int needs_own_process(char* cmd) {
+    const internal_pair* entry = find_internal(cmd);
+    return entry ? entry->needs_own_process : 0;
+}
+
+int internal_echo(const command* cmd) {
     char buffer[BUFFER_SIZE];
 
     for (size_t i = 1; i < cmd->argc; ++i) {
@@ -25,9 +52,10 @@ void internal_echo(const command* cmd) {
     }
     int size = snprintf(buffer, BUFFER_SIZE, "\n");
     write(STDOUT_FILENO, buffer, strlen(buffer));
+    return 0;
 }
 
-void internal_pwd(const command* cmd) {
+int internal_pwd(const command* cmd) {
     char cwd[PATH_MAX];
     
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
@@ -35,14 +63,16 @@ void internal_pwd(const command* cmd) {
     }
     else {
         perror("pwd failed");
+        return 1;
     }
+    return 0;
 }
 
-void internal_cd(const command* cmd) {
+int internal_cd(const command* cmd) {
     char* target_dir;
     
     if (cmd->argc == 1) {
-        target_dir = getenv("HOME");
+        target_dir = get_var("HOME");
         if (target_dir == NULL) {
             target_dir = "/";
         }
@@ -53,80 +83,59 @@ void internal_cd(const command* cmd) {
     
     if (chdir(target_dir) != 0) {
         perror("cd");
+        return 1;
     }
+    prompt_invalidate_cwd();
+    return 0;
 }
 
-void internal_ls(const command* cmd) {
-    char cwd[PATH_MAX];
-    if (getcwd(cwd, sizeof(cwd)) == NULL) {
-        printf("pwd failed");
-        return;
-    }
-
-    DIR* dir = opendir(cwd);
-
-    if (!dir) {
-        perror("opendir failed");
-        return;
-    }
-
-    struct dirent* dr;
-
-    while ((dr = readdir(dir))) {
-        if (dr->d_name[0] != '.')
-            printf("%s\n", dr->d_name);
-    }
-    closedir(dir);
-}
-
-void internal_cat(const command* cmd) {
+int internal_cat(const command* cmd) {
     if (cmd->argc < 2) {
         // cat with no arguments - read from stdin
-        char buffer[BUFFER_SIZE];
-        ssize_t bytesRead;
-        while ((bytesRead = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
-            if (write(STDOUT_FILENO, buffer, bytesRead) == -1) {
-                perror("write failed");
-                break;
-            }
-        }
-        if (bytesRead == -1) {
-            perror("read failed");
+        if (copy_fd(STDIN_FILENO, STDOUT_FILENO) < 0) {
+            if (interrupted) return 130;
+            if (errno != EPIPE) perror("cat");
+            return 1;
         }
-        return;
+        return 0;
     }
 
     // cat with file arguments
+    int status = 0;
     for (size_t i = 1; i < cmd->argc; ++i) {
         int fd = open(cmd->argv[i], O_RDONLY);
 
+        // Ctrl+C, while the shell itself was copying or opening a fifo
+        if (interrupted) {
+            if (fd >= 0) close(fd);
+            return 130;
+        }
         if (fd < 0) {
             fprintf(stderr, "cat: %s: %s\n", cmd->argv[i], strerror(errno));
+            status = 1;
             continue;
         }
 
-        char buffer[BUFFER_SIZE];
-        ssize_t bytesRead;
-        while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0) {
-            if (write(STDOUT_FILENO, buffer, bytesRead) == -1) {
-                perror("write failed");
-                break;
+        if (copy_fd(fd, STDOUT_FILENO) < 0) {
+            if (errno == EPIPE) {   // the reader is gone
+                close(fd);
+                return 1;
             }
-        }
-        
-        if (bytesRead == -1) {
-            perror("read failed");
+            fprintf(stderr, "cat: %s: %s\n", cmd->argv[i], strerror(errno));
+            status = 1;
         }
         
         close(fd);
     }
+    return status;
 }
 
-void internal_jobs(const command* cmd) {
+int internal_jobs(const command* cmd) {
     print_jobs();
+    return 0;
 }
 
-void internal_fg(const command* cmd) {
+int internal_fg(const command* cmd) {
     job_t* job = NULL;
 
     if (cmd->argc > 1) {
@@ -147,12 +156,12 @@ void internal_fg(const command* cmd) {
 
     if (!job) {
         fprintf(stderr, "fg: no JOB found\n");
-        return;
+        return 1;
     }
 
     if (job->status == JOB_RUNNING && fg_pgid == job->pgid) {
         fprintf(stderr, "fg: job already in foreground\n");
-        return;
+        return 1;
     }
 
     fg_pgid = job->pgid;
@@ -160,47 +169,23 @@ void internal_fg(const command* cmd) {
     if (kill(-job->pgid, SIGCONT) < 0) {
         perror("kill SIGCONT");
         fg_pgid = 0;
-        return;
+        return 1;
     }
 
     if (tcsetpgrp(STDIN_FILENO, job->pgid) < 0) {
         perror("tcsetpgrp");
         fg_pgid = 0;
-        return;
+        return 1;
     }
 
     update_all_processes_in_job(job, JOB_RUNNING);
     
     printf("%s\n", job->command_line);
 
-    int status;
-    pid_t pid;
-    int processes_remaining = count_processes_in_job(job); 
-    
-    while (processes_remaining > 0) {
-        pid = waitpid(-1, &status, WUNTRACED);
-        
-        if (pid < 0) {
-            if (errno == EINTR) continue;
-            if (errno == ECHILD) break;
-            perror("waitpid");
-            break;
-        }
-        
-        if (pid == 0) continue;
-        
-        pid_t process_pgid = get_pgid_of_process(pid);
-        if (process_pgid != job->pgid) continue; 
-        
-        if (WIFSTOPPED(status)) {
-            update_job_status(job, pid, JOB_STOPPED);
-            printf("\n[%d]+  Stopped\t%s\n", job->job_id, job->command_line);
-            break; 
-        } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            update_job_status(job, pid, JOB_DONE);
-            processes_remaining--;
-        }
-    }
+    wait_for_job(job);
+
+    if (job_is_stopped(job))
+        printf("\n[%d]+  Stopped\t%s\n", job->job_id, job->command_line);
     
     if (shell_interactive) {
         if (tcsetpgrp(shell_tty, shell_pgid) < 0) {
@@ -208,13 +193,15 @@ void internal_fg(const command* cmd) {
         }
     }
     fg_pgid = 0;
-    
+
+    int status = job_exit_status(job);
     if (job->status == JOB_DONE || all_processes_done(job)) {
-        remove_job(job);
+        remove_job(job->job_id);
     }
+    return status;
 }
 
-void internal_bg(const command* cmd) {
+int internal_bg(const command* cmd) {
     job_t* job = NULL;
 
     if (cmd->argc > 1) {
@@ -231,48 +218,53 @@ void internal_bg(const command* cmd) {
     } else {
         if (!job) {
             fprintf(stderr, "bg: no current job\n");
-            return;
+            return 1;
         }
     }
 
     if (!job) {
         fprintf(stderr, "bg: no such job\n");
-        return;
+        return 1;
     }
     
     if (job->status != JOB_STOPPED && !job_is_stopped(job)) {
         printf("bg: job [%d] already running\n", job->job_id);
-        return;
+        return 1;
     }
     
     if (kill(-job->pgid, SIGCONT) < 0) {
         perror("kill SIGCONT");
-        return;
+        return 1;
     }
     
     update_all_processes_in_job(job, JOB_RUNNING);
     
     printf("[%d] %s &\n", job->job_id, job->command_line);
+    return 0;
 }
 
-void internal_env(const command* cmd) {
+int internal_env(const command* cmd) {
     if (cmd->argc == 1)
         print_all_var();
     else {
         fprintf(stderr, "env: invalid format, too many arguments\n");
+        return 1;
     }
+    return 0;
 }
 
-void internal_set(const command* cmd) {
+int internal_set(const command* cmd) {
     if (cmd->argc < 2) {
         fprintf(stderr, "set: invalid format, not enough arguments\n");
-        return;
+        return 1;
     }
     
+    int status = 0;
     for (int i = 1; i < cmd->argc; i++) {
         char *eq = strchr(cmd->argv[i], '=');
         if (!eq) {
             fprintf(stderr, "set: invalid format, use NAME=value\n");
+            status = 1;
             continue;
         }
 
@@ -287,41 +279,148 @@ void internal_set(const command* cmd) {
         
         free(arg_copy);
     }
+    return status;
 }
 
-void internal_export(const const command* cmd) {
+int internal_export(const command* cmd) {
     if (cmd->argc < 2) {
         fprintf(stderr, "Usage: export VAR\n");
-        return;
+        return 1;
     }
 
+    int status = 0;
     for (int i = 1; i < cmd->argc; i++) {
         const char *name = cmd->argv[i];
         const char *value = get_var(name); 
 
         if (!value) {
             fprintf(stderr, "export: variable '%s' not found\n", name);
+            status = 1;
             continue;
         }
 
-        if (setenv(name, value, 1) != 0) {
-            perror("setenv");
-            return;
-        }
+        if (export_var(name) < 0)
+            return 1;
     }
-    return;
+    return status;
 }
 
-void internal_unset(const const command* cmd) {
+int internal_unset(const command* cmd) {
     if (cmd->argc < 2) {
         fprintf(stderr, "Usage: unset VAR\n");
-        return;
+        return 1;
     }
 
     for (int i = 1; i < cmd->argc; i++) {
         const char *name = cmd->argv[i];
         unset_var(name);
-        unsetenv(name);
     }
-    return;
+    return 0;
+}
+
+int internal_hash(const command* cmd) {
+    if (cmd->argc == 1) {
+        pathcache_print();
+        return 0;
+    }
+
+    if (strcmp(cmd->argv[1], "-r") == 0) {
+        pathcache_clear();
+        return 0;
+    }
+
+    if (strcmp(cmd->argv[1], "-s") == 0) {
+        pathcache_print_stats();
+        return 0;
+    }
+
+    if (strcmp(cmd->argv[1], "-d") == 0) {
+        for (size_t i = 2; i < cmd->argc; ++i)
+            pathcache_forget(cmd->argv[i]);
+        return 0;
+    }
+
+    // hash NAME... resolves and remembers NAME ahead of time
+    int status = 0;
+    for (size_t i = 1; i < cmd->argc; ++i) {
+        if (get_internal_func(cmd->argv[i]) != NULL)
+            continue;
+        if (pathcache_warm(cmd->argv[i]) < 0) {
+            fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int internal_shellstats(const command* cmd) {
+    if (cmd->argc == 1) {
+        trace_print_stats();
+    } else if (cmd->argc == 2 && strcmp(cmd->argv[1], "-r") == 0) {
+        trace_reset_stats();
+    } else {
+        fprintf(stderr, "Usage: shellstats [-r]\n");
+        return 1;
+    }
+    return 0;
+}
+
+int internal_exec(const command* cmd) {
+    command target = *cmd;
+
+    // 'exec > file' with no command makes the redirections permanent
+    if (cmd->argc < 2)
+        return redirect_fds(&target) < 0;
+
+    target.argc = cmd->argc - 1;
+    target.argv = cmd->argv + 1;
+
+    if (exec_command(&target) < 0 && !shell_interactive)
+        exit(127);
+    return 127;
+}
+
+int internal_true(const command* cmd) {
+    (void)cmd;
+    return 0;
+}
+
+int internal_false(const command* cmd) {
+    (void)cmd;
+    return 1;
+}
+
+// break [n] / continue [n]: the loop runner sees loop_levels and unwinds
+// that many loops, resuming the last one for continue
+static int loop_jump(const command* cmd, int resume) {
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", cmd->argv[0]);
+        return 0;
+    }
+
+    int levels = (cmd->argc > 1) ? atoi(cmd->argv[1]) : 1;
+    if (levels < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", cmd->argv[0], cmd->argv[1]);
+        return 1;
+    }
+    loop_levels = (levels > loop_depth) ? loop_depth : levels;
+    loop_continue = resume;
+    return 0;
+}
+
+int internal_break(const command* cmd) {
+    return loop_jump(cmd, 0);
+}
+
+int internal_continue(const command* cmd) {
+    return loop_jump(cmd, 1);
+}
+
+// Leaves once the current line is done with, with the given status or
+// that of the last command
+int internal_exit(const command* cmd) {
+    if (cmd->argc > 1)
+        last_status = atoi(cmd->argv[1]) & 0xff;
+    exit_requested = 1;
+    return last_status;
 }
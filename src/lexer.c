@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include "../headers/lexer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Bytes that end a run of ordinary word characters. NUL is included so
+// scanning always stops at the end of the line.
+static const char special_chars[] = { '\0', ' ', '\t', '\n', '|', '&', ';', '<', '>',
+                                      '(', ')', '\'', '"', '\\', '$', '`' };
+
+static unsigned char is_special[256];
+
+static void init_special_table(void) {
+    static int ready = 0;
+    if (ready) return;
+    for (size_t i = 0; i < sizeof(special_chars); ++i)
+        is_special[(unsigned char)special_chars[i]] = 1;
+    ready = 1;
+}
+
+#ifdef __SSE2__
+// 16 bytes at a time: one compare per special byte, OR-ed into a mask.
+// Loads are 16-byte aligned so they never cross into an unmapped page,
+// even when they run past the terminating NUL.
+__attribute__((no_sanitize_address))
+static size_t scan_plain(const char* p) {
+    const char* base = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned int mask = 0xFFFFu << (p - base);
+
+    while (1) {
+        __m128i chunk = _mm_load_si128((const __m128i*)base);
+        __m128i hits = _mm_setzero_si128();
+        for (size_t i = 0; i < sizeof(special_chars); ++i)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(special_chars[i])));
+
+        unsigned int found = (unsigned int)_mm_movemask_epi8(hits) & mask;
+        if (found)
+            return base + __builtin_ctz(found) - p;
+
+        base += 16;
+        mask = 0xFFFFu;
+    }
+}
+#else
+static size_t scan_plain(const char* p) {
+    const char* start = p;
+    while (!is_special[(unsigned char)*p])
+        p++;
+    return p - start;
+}
+#endif
+
+static int is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+void lexer_init(lexer* lx, arena* a, const char* line) {
+    init_special_table();
+
+    size_t len = strlen(line);
+    lx->a = a;
+    lx->pos = line;
+    lx->error = NULL;
+    lx->incomplete = 0;
+    // unescaped text never outgrows the line, plus one NUL per part
+    lx->out = arena_alloc(a, 2 * len + 2);
+}
+
+const char* token_name(token_type type) {
+    switch (type) {
+        case TOK_PIPE: return "|";
+        case TOK_REDIR_IN: return "<";
+        case TOK_REDIR_OUT: return ">";
+        case TOK_REDIR_APPEND: return ">>";
+        case TOK_BACKGROUND: return "&";
+        case TOK_AND: return "&&";
+        case TOK_OR: return "||";
+        case TOK_SEMI: return ";";
+        case TOK_DSEMI: return ";;";
+        case TOK_NEWLINE: return "newline";
+        case TOK_LPAREN: return "(";
+        case TOK_RPAREN: return ")";
+        case TOK_END: return "newline";
+        default: return "word";
+    }
+}
+
+typedef struct {
+    lexer* lx;
+    word* w;
+    word_part** tail;
+    char* part_start;
+} word_builder;
+
+static int add_part(word_builder* b, int type, char* text, size_t len) {
+    word_part* part = arena_alloc(b->lx->a, sizeof(word_part));
+    if (part == NULL) return -1;
+
+    part->type = type;
+    part->text = text;
+    part->len = len;
+    part->next = NULL;
+    *b->tail = part;
+    b->tail = &part->next;
+    return 0;
+}
+
+// Closes the literal text written since the last part, if there is any
+static int flush_literal(word_builder* b) {
+    lexer* lx = b->lx;
+    if (lx->out == b->part_start) return 0;
+
+    size_t len = lx->out - b->part_start;
+    *lx->out++ = '\0';
+    int r = add_part(b, PART_LITERAL, b->part_start, len);
+    b->part_start = lx->out;
+    return r;
+}
+
+// $(...): the text up to the matching ')', quotes and nesting respected.
+// It is parsed and run only when the word is expanded.
+static int lex_command(word_builder* b) {
+    lexer* lx = b->lx;
+    const char* start = lx->pos + 2;
+    const char* p = start;
+    int depth = 1;
+
+    for (; *p; ++p) {
+        if (*p == '\\' && p[1] != '\0') {
+            ++p;
+        } else if (*p == '\'') {
+            const char* end = strchr(p + 1, '\'');
+            if (end == NULL) break;
+            p = end;
+        } else if (*p == '"') {
+            for (++p; *p && *p != '"'; ++p)
+                if (*p == '\\' && p[1] != '\0') ++p;
+            if (*p == '\0') break;
+        } else if (*p == '(') {
+            ++depth;
+        } else if (*p == ')' && --depth == 0) {
+            break;
+        }
+    }
+    if (*p != ')') {
+        lx->error = "unterminated command substitution";
+        lx->incomplete = 1;
+        return -1;
+    }
+
+    if (flush_literal(b) < 0) return -1;
+
+    size_t len = p - start;
+    char* text = lx->out;
+    memcpy(text, start, len);
+    lx->out += len;
+    *lx->out++ = '\0';
+    b->part_start = lx->out;
+
+    lx->pos = p + 1;
+    return add_part(b, PART_COMMAND, text, len);
+}
+
+// $((...)): the expression up to the '))' that closes it, evaluated when
+// the word is expanded
+static int lex_arith(word_builder* b) {
+    lexer* lx = b->lx;
+    const char* start = lx->pos + 3;
+    const char* p = start;
+    int depth = 0;
+
+    for (; *p; ++p) {
+        if (*p == '(') {
+            ++depth;
+        } else if (*p == ')') {
+            if (depth == 0) break;
+            --depth;
+        }
+    }
+    if (p[0] != ')' || p[1] != ')') {
+        lx->error = "unterminated arithmetic expansion";
+        lx->incomplete = (*p == '\0');
+        return -1;
+    }
+
+    if (flush_literal(b) < 0) return -1;
+
+    size_t len = p - start;
+    char* text = lx->out;
+    memcpy(text, start, len);
+    lx->out += len;
+    *lx->out++ = '\0';
+    b->part_start = lx->out;
+
+    lx->pos = p + 2;
+    return add_part(b, PART_ARITH, text, len);
+}
+
+// `...`: in here a backslash only escapes `, \ and $
+static int lex_backquoted(word_builder* b) {
+    lexer* lx = b->lx;
+    if (flush_literal(b) < 0) return -1;
+
+    char* text = lx->out;
+    const char* p = lx->pos + 1;
+    for (; *p != '`'; ++p) {
+        if (*p == '\0') {
+            lx->error = "unterminated command substitution";
+            lx->incomplete = 1;
+            return -1;
+        }
+        if (*p == '\\' && (p[1] == '`' || p[1] == '\\' || p[1] == '$')) ++p;
+        *lx->out++ = *p;
+    }
+
+    size_t len = lx->out - text;
+    *lx->out++ = '\0';
+    b->part_start = lx->out;
+
+    lx->pos = p + 1;
+    return add_part(b, PART_COMMAND, text, len);
+}
+
+// $NAME or ${NAME}; a '$' not followed by a name stays literal
+static int lex_variable(word_builder* b) {
+    lexer* lx = b->lx;
+    const char* p = lx->pos + 1;
+    if (p[0] == '(' && p[1] == '(')
+        return lex_arith(b);
+    if (*p == '(')
+        return lex_command(b);
+
+    // $? is the status of the last command
+    if (*p == '?') {
+        if (flush_literal(b) < 0) return -1;
+        char* text = lx->out;
+        *lx->out++ = '?';
+        *lx->out++ = '\0';
+        b->part_start = lx->out;
+        lx->pos = p + 1;
+        return add_part(b, PART_VAR, text, 1);
+    }
+
+    int braced = (*p == '{');
+    if (braced) p++;
+
+    if (!is_name_start(*p)) {
+        *lx->out++ = '$';
+        lx->pos++;
+        return 0;
+    }
+
+    const char* name = p;
+    while (is_name_char(*p)) p++;
+    size_t len = p - name;
+
+    if (braced) {
+        if (*p != '}') {
+            lx->error = "bad substitution";
+            return -1;
+        }
+        p++;
+    }
+
+    if (flush_literal(b) < 0) return -1;
+
+    memcpy(lx->out, name, len);
+    char* text = lx->out;
+    lx->out += len;
+    *lx->out++ = '\0';
+    b->part_start = lx->out;
+
+    lx->pos = p;
+    return add_part(b, PART_VAR, text, len);
+}
+
+static int lex_single_quoted(word_builder* b) {
+    lexer* lx = b->lx;
+    const char* start = lx->pos + 1;
+    const char* end = strchr(start, '\'');
+    if (end == NULL) {
+        lx->error = "unterminated quote";
+        lx->incomplete = 1;
+        return -1;
+    }
+
+    memcpy(lx->out, start, end - start);
+    lx->out += end - start;
+    lx->pos = end + 1;
+    return 0;
+}
+
+static int lex_double_quoted(word_builder* b) {
+    lexer* lx = b->lx;
+    lx->pos++;
+
+    while (*lx->pos != '"') {
+        char c = *lx->pos;
+        if (c == '\0') {
+            lx->error = "unterminated quote";
+            lx->incomplete = 1;
+            return -1;
+        }
+
+        if (c == '$') {
+            if (lex_variable(b) < 0) return -1;
+        } else if (c == '`') {
+            if (lex_backquoted(b) < 0) return -1;
+        } else if (c == '\\' && (lx->pos[1] == '"' || lx->pos[1] == '\\'
+                                 || lx->pos[1] == '$' || lx->pos[1] == '`')) {
+            *lx->out++ = lx->pos[1];
+            lx->pos += 2;
+        } else {
+            *lx->out++ = c;
+            lx->pos++;
+        }
+    }
+
+    lx->pos++;
+    return 0;
+}
+
+static token_type lex_word(lexer* lx, token* tok) {
+    word* w = &tok->w;
+    w->parts = NULL;
+    w->literal = NULL;
+    w->quoted = 0;
+
+    word_builder b = { lx, w, &w->parts, lx->out };
+
+    while (1) {
+        size_t n = scan_plain(lx->pos);
+        if (n > 0) {
+            memcpy(lx->out, lx->pos, n);
+            lx->out += n;
+            lx->pos += n;
+        }
+
+        char c = *lx->pos;
+        int r = 0;
+
+        if (c == '\0' || c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&'
+            || c == '<' || c == '>' || c == ';' || c == '(' || c == ')') {
+            break;
+        } else if (c == '\\' && lx->pos[1] == '\n') {
+            // an escaped newline joins the lines
+            lx->pos += 2;
+        } else if (c == '\\') {
+            w->quoted = 1;
+            if (lx->pos[1] != '\0') {
+                *lx->out++ = lx->pos[1];
+                lx->pos += 2;
+            } else {
+                lx->pos++;
+            }
+        } else if (c == '\'') {
+            w->quoted = 1;
+            r = lex_single_quoted(&b);
+        } else if (c == '"') {
+            w->quoted = 1;
+            r = lex_double_quoted(&b);
+        } else if (c == '$') {
+            r = lex_variable(&b);
+        } else if (c == '`') {
+            r = lex_backquoted(&b);
+        } else {
+            // not an operator (yet): part of the word
+            *lx->out++ = c;
+            lx->pos++;
+        }
+
+        if (r < 0) return tok->type = TOK_ERROR;
+    }
+
+    // "" and '' are real, empty words
+    if (lx->out == b.part_start && w->parts == NULL) {
+        *lx->out++ = '\0';
+        add_part(&b, PART_LITERAL, b.part_start, 0);
+    } else if (flush_literal(&b) < 0) {
+        return tok->type = TOK_ERROR;
+    }
+
+    if (w->parts->next == NULL && w->parts->type == PART_LITERAL)
+        w->literal = w->parts->text;
+
+    return tok->type = TOK_WORD;
+}
+
+token_type lexer_next(lexer* lx, token* tok) {
+    while (*lx->pos == ' ' || *lx->pos == '\t'
+           || (lx->pos[0] == '\\' && lx->pos[1] == '\n'))
+        lx->pos += (*lx->pos == '\\') ? 2 : 1;
+
+    // a comment runs to the end of the line
+    if (*lx->pos == '#') {
+        lx->pos = strchrnul(lx->pos, '\n');
+    }
+
+    tok->start = lx->pos;
+    switch (*lx->pos) {
+        case '\0':
+            return tok->type = TOK_END;
+        case '\n':
+            lx->pos++;
+            return tok->type = TOK_NEWLINE;
+        case '|':
+            if (lx->pos[1] == '|') {
+                lx->pos += 2;
+                return tok->type = TOK_OR;
+            }
+            lx->pos++;
+            return tok->type = TOK_PIPE;
+        case '&':
+            if (lx->pos[1] == '&') {
+                lx->pos += 2;
+                return tok->type = TOK_AND;
+            }
+            lx->pos++;
+            return tok->type = TOK_BACKGROUND;
+        case ';':
+            if (lx->pos[1] == ';') {
+                lx->pos += 2;
+                return tok->type = TOK_DSEMI;
+            }
+            lx->pos++;
+            return tok->type = TOK_SEMI;
+        case '(':
+            lx->pos++;
+            return tok->type = TOK_LPAREN;
+        case ')':
+            lx->pos++;
+            return tok->type = TOK_RPAREN;
+        case '<':
+            lx->pos++;
+            return tok->type = TOK_REDIR_IN;
+        case '>':
+            if (lx->pos[1] == '>') {
+                lx->pos += 2;
+                return tok->type = TOK_REDIR_APPEND;
+            }
+            lx->pos++;
+            return tok->type = TOK_REDIR_OUT;
+        default:
+            return lex_word(lx, tok);
+    }
+}
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include "../headers/internalfuncs.h"
+
+#include <grp.h>
+#include <pwd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// ls [-la1] [path...]
+//
+// Entries come from getdents64 in large batches and their names are
+// packed into one buffer. Sorting compares an 8-byte big-endian prefix
+// held next to each name pointer, so most comparisons never touch the
+// names. statx is only called for -l. Everything is written through one
+// buffer, flushed when full.
+
+#define LS_DENTS_BUF (256 * 1024)
+#define LS_OUT_BUF (64 * 1024)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    uint64_t key;       // first 8 bytes of the name, big-endian
+    const char* name;
+    size_t len;
+} ls_entry;
+
+typedef struct {
+    int all;
+    int long_format;
+    int one_per_line;
+} ls_options;
+
+typedef struct {
+    char buf[LS_OUT_BUF];
+    size_t len;
+    int failed;
+} ls_writer;
+
+static void out_flush(ls_writer* w) {
+    size_t done = 0;
+    while (done < w->len && !w->failed) {
+        ssize_t n = write(STDOUT_FILENO, w->buf + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR && !interrupted) continue;
+            w->failed = 1;  // e.g. a closed pipe, or Ctrl+C; stop writing
+            break;
+        }
+        done += n;
+    }
+    w->len = 0;
+}
+
+static void out_write(ls_writer* w, const char* s, size_t len) {
+    // pieces are at most a path plus a long-format line, far below LS_OUT_BUF
+    if (w->len + len > LS_OUT_BUF) out_flush(w);
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+}
+
+static void out_puts(ls_writer* w, const char* s) {
+    out_write(w, s, strlen(s));
+}
+
+static void out_pad(ls_writer* w, size_t n) {
+    static const char spaces[] = "                                ";
+    while (n > 0) {
+        size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        out_write(w, spaces, k);
+        n -= k;
+    }
+}
+
+static uint64_t name_key(const char* name, size_t len) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; ++i)
+        key = (key << 8) | (i < len ? (unsigned char)name[i] : 0);
+    return key;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const ls_entry* x = a;
+    const ls_entry* y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    // equal keys: both names are at least 8 bytes long or identical
+    if (x->len <= 8 || y->len <= 8) return (x->len > y->len) - (x->len < y->len);
+    return strcmp(x->name + 8, y->name + 8);
+}
+
+typedef struct {
+    ls_entry* entries;
+    size_t count, cap;
+    char* names;        // every name, NUL-terminated, back to back
+    size_t names_len, names_cap;
+} ls_listing;
+
+static void free_listing(ls_listing* l) {
+    free(l->entries);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+static int add_name(ls_listing* l, const char* name, size_t len) {
+    if (l->count == l->cap) {
+        size_t new_cap = l->cap ? l->cap * 2 : 256;
+        ls_entry* grown = realloc(l->entries, new_cap * sizeof(ls_entry));
+        if (grown == NULL) return -1;
+        l->entries = grown;
+        l->cap = new_cap;
+    }
+    if (l->names_len + len + 1 > l->names_cap) {
+        size_t new_cap = l->names_cap ? l->names_cap * 2 : 16384;
+        while (new_cap < l->names_len + len + 1) new_cap *= 2;
+        char* grown = realloc(l->names, new_cap);
+        if (grown == NULL) return -1;
+        l->names = grown;
+        l->names_cap = new_cap;
+    }
+    memcpy(l->names + l->names_len, name, len + 1);
+    // names may still move; store the offset until reading is done
+    l->entries[l->count].name = (const char*)(uintptr_t)l->names_len;
+    l->entries[l->count].len = len;
+    l->entries[l->count].key = name_key(name, len);
+    l->count++;
+    l->names_len += len + 1;
+    return 0;
+}
+
+static int read_dir(int fd, int all, ls_listing* l) {
+    char* buf = malloc(LS_DENTS_BUF);
+    if (buf == NULL) return -1;
+
+    while (1) {
+        long n = syscall(SYS_getdents64, fd, buf, LS_DENTS_BUF);
+        if (n < 0) {
+            if (errno == EINTR && !interrupted) continue;
+            free(buf);
+            return -1;
+        }
+        if (n == 0) break;
+
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64* d = (struct linux_dirent64*)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && !all) continue;
+            if (add_name(l, d->d_name, strlen(d->d_name)) < 0) {
+                free(buf);
+                return -1;
+            }
+        }
+    }
+    free(buf);
+
+    for (size_t i = 0; i < l->count; ++i)
+        l->entries[i].name = l->names + (uintptr_t)l->entries[i].name;
+    qsort(l->entries, l->count, sizeof(ls_entry), compare_entries);
+    return 0;
+}
+
+static void print_columns(ls_writer* w, const ls_entry* entries, size_t count) {
+    size_t width = 0;
+    for (size_t i = 0; i < count; ++i)
+        if (entries[i].len > width) width = entries[i].len;
+    width += 2;
+
+    struct winsize ws;
+    size_t cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) cols = ws.ws_col;
+    size_t per_row = cols / width ? cols / width : 1;
+    size_t rows = (count + per_row - 1) / per_row;
+
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c < per_row; ++c) {
+            size_t i = c * rows + r;
+            if (i >= count) break;
+            out_write(w, entries[i].name, entries[i].len);
+            if (i + rows < count) out_pad(w, width - entries[i].len);
+        }
+        out_write(w, "\n", 1);
+    }
+}
+
+static void mode_string(mode_t mode, char* s) {
+    s[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c'
+         : S_ISBLK(mode) ? 'b' : S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+    static const char rwx[] = "rwxrwxrwx";
+    for (int i = 0; i < 9; ++i)
+        s[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    if (mode & S_ISUID) s[3] = (mode & S_IXUSR) ? 's' : 'S';
+    if (mode & S_ISGID) s[6] = (mode & S_IXGRP) ? 's' : 'S';
+    if (mode & S_ISVTX) s[9] = (mode & S_IXOTH) ? 't' : 'T';
+    s[10] = '\0';
+}
+
+// Owners repeat within a directory; remember the last lookup of each kind
+static const char* user_name(uid_t uid) {
+    static uid_t cached = (uid_t)-1;
+    static char name[64];
+    if (uid != cached) {
+        struct passwd* pw = getpwuid(uid);
+        if (pw) snprintf(name, sizeof(name), "%s", pw->pw_name);
+        else snprintf(name, sizeof(name), "%u", (unsigned)uid);
+        cached = uid;
+    }
+    return name;
+}
+
+static const char* group_name(gid_t gid) {
+    static gid_t cached = (gid_t)-1;
+    static char name[64];
+    if (gid != cached) {
+        struct group* gr = getgrgid(gid);
+        if (gr) snprintf(name, sizeof(name), "%s", gr->gr_name);
+        else snprintf(name, sizeof(name), "%u", (unsigned)gid);
+        cached = gid;
+    }
+    return name;
+}
+
+#define LS_STATX_MASK (STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID \
+                       | STATX_SIZE | STATX_MTIME | STATX_BLOCKS)
+
+typedef struct {
+    int ok;
+    struct statx st;
+    char user[64];
+    char group[64];
+} ls_stat;
+
+static void print_long(ls_writer* w, int dirfd, const ls_entry* entries, size_t count, int total) {
+    ls_stat* stats = calloc(count ? count : 1, sizeof(ls_stat));
+    if (stats == NULL) {
+        perror("allocation failed");
+        return;
+    }
+
+    int nlink_w = 1, user_w = 1, group_w = 1, size_w = 1;
+    unsigned long long blocks = 0;
+    for (size_t i = 0; i < count; ++i) {
+        ls_stat* s = &stats[i];
+        if (statx(dirfd, entries[i].name, AT_SYMLINK_NOFOLLOW, LS_STATX_MASK, &s->st) < 0) {
+            fprintf(stderr, "ls: cannot access '%s': %s\n", entries[i].name, strerror(errno));
+            continue;
+        }
+        s->ok = 1;
+        snprintf(s->user, sizeof(s->user), "%s", user_name(s->st.stx_uid));
+        snprintf(s->group, sizeof(s->group), "%s", group_name(s->st.stx_gid));
+        blocks += s->st.stx_blocks;
+
+        char num[32];
+        int n = snprintf(num, sizeof(num), "%u", s->st.stx_nlink);
+        if (n > nlink_w) nlink_w = n;
+        n = snprintf(num, sizeof(num), "%llu", (unsigned long long)s->st.stx_size);
+        if (n > size_w) size_w = n;
+        n = strlen(s->user);
+        if (n > user_w) user_w = n;
+        n = strlen(s->group);
+        if (n > group_w) group_w = n;
+    }
+
+    char line[PATH_MAX + 256];
+    if (total) {
+        // stx_blocks counts 512-byte units; ls reports KiB
+        snprintf(line, sizeof(line), "total %llu\n", blocks / 2);
+        out_puts(w, line);
+    }
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < count; ++i) {
+        const ls_stat* s = &stats[i];
+        if (!s->ok) continue;
+
+        char mode[11];
+        mode_string(s->st.stx_mode, mode);
+
+        // recent files show the time, older ones (or future ones) the year
+        time_t mtime = s->st.stx_mtime.tv_sec;
+        struct tm tm;
+        localtime_r(&mtime, &tm);
+        char date[32];
+        int recent = mtime <= now && now - mtime < 6L * 30 * 24 * 3600;
+        strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+        snprintf(line, sizeof(line), "%s %*u %-*s %-*s %*llu %s ",
+                 mode, nlink_w, s->st.stx_nlink, user_w, s->user, group_w, s->group,
+                 size_w, (unsigned long long)s->st.stx_size, date);
+        out_puts(w, line);
+        out_write(w, entries[i].name, entries[i].len);
+
+        if (S_ISLNK(s->st.stx_mode)) {
+            char target[PATH_MAX];
+            ssize_t n = readlinkat(dirfd, entries[i].name, target, sizeof(target));
+            if (n >= 0) {
+                out_puts(w, " -> ");
+                out_write(w, target, n);
+            }
+        }
+        out_write(w, "\n", 1);
+    }
+    free(stats);
+}
+
+static void print_entries(ls_writer* w, const ls_options* opt, int dirfd,
+                          const ls_entry* entries, size_t count, int total) {
+    if (opt->long_format)
+        print_long(w, dirfd, entries, count, total);
+    else if (opt->one_per_line)
+        for (size_t i = 0; i < count; ++i) {
+            out_write(w, entries[i].name, entries[i].len);
+            out_write(w, "\n", 1);
+        }
+    else
+        print_columns(w, entries, count);
+}
+
+static int list_dir(ls_writer* w, const ls_options* opt, const char* path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ls: cannot open directory '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    ls_listing l = {0};
+    if (read_dir(fd, opt->all, &l) < 0) {
+        fprintf(stderr, "ls: reading directory '%s': %s\n", path, strerror(errno));
+        free_listing(&l);
+        close(fd);
+        return -1;
+    }
+
+    print_entries(w, opt, fd, l.entries, l.count, 1);
+    free_listing(&l);
+    close(fd);
+    return 0;
+}
+
+int internal_ls(const command* cmd) {
+    ls_options opt = {0};
+    // the default layout is for people; pipes and files get one name per line
+    opt.one_per_line = !isatty(STDOUT_FILENO);
+
+    size_t i = 1;
+    for (; i < cmd->argc; ++i) {
+        const char* arg = cmd->argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') break;
+        if (strcmp(arg, "--") == 0) {
+            ++i;
+            break;
+        }
+        for (const char* f = arg + 1; *f; ++f) {
+            switch (*f) {
+                case 'a': opt.all = 1; break;
+                case 'l': opt.long_format = 1; break;
+                case '1': opt.one_per_line = 1; break;
+                default:
+                    fprintf(stderr, "ls: invalid option -- '%c'\n"
+                                    "usage: ls [-la1] [path...]\n", *f);
+                    return 1;
+            }
+        }
+    }
+
+    const char* here = ".";
+    const char* const* paths = (const char* const*)cmd->argv + i;
+    size_t path_count = cmd->argc - i;
+    if (path_count == 0) {
+        paths = &here;
+        path_count = 1;
+    }
+
+    ls_writer* w = malloc(sizeof(ls_writer));
+    if (w == NULL) {
+        perror("allocation failed");
+        return 1;
+    }
+    w->len = 0;
+    w->failed = 0;
+    fflush(stdout);
+
+    // like ls(1): files named on the command line first, then directories
+    int status = 0;
+    ls_listing files = {0};
+    int* is_dir = calloc(path_count, sizeof(int));
+    if (is_dir == NULL) {
+        perror("allocation failed");
+        free(w);
+        return 1;
+    }
+    for (size_t p = 0; p < path_count; ++p) {
+        struct statx st;
+        if (statx(AT_FDCWD, paths[p], 0, STATX_TYPE, &st) < 0) {
+            fprintf(stderr, "ls: cannot access '%s': %s\n", paths[p], strerror(errno));
+            is_dir[p] = -1;
+            status = 1;
+        } else if (S_ISDIR(st.stx_mode)) {
+            is_dir[p] = 1;
+        } else {
+            add_name(&files, paths[p], strlen(paths[p]));
+        }
+    }
+    for (size_t k = 0; k < files.count; ++k)
+        files.entries[k].name = files.names + (uintptr_t)files.entries[k].name;
+    qsort(files.entries, files.count, sizeof(ls_entry), compare_entries);
+    print_entries(w, &opt, AT_FDCWD, files.entries, files.count, 0);
+
+    int printed = files.count > 0;
+    for (size_t p = 0; p < path_count && !interrupted; ++p) {
+        if (is_dir[p] != 1) continue;
+        if (path_count > 1) {
+            if (printed) out_write(w, "\n", 1);
+            out_puts(w, paths[p]);
+            out_write(w, ":\n", 2);
+        }
+        if (list_dir(w, &opt, paths[p]) < 0)
+            status = 1;
+        printed = 1;
+    }
+
+    out_flush(w);
+    free_listing(&files);
+    free(is_dir);
+    free(w);
+    return status;
+}
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include "../headers/internalfuncs.h"
+#include "../headers/spawn.h"
+#include "../headers/input.h"
+#include "../headers/events.h"
+
+#include <poll.h>
+
+// parallel [-j N] [-k] [--tag] command [args...] [::: items...]
+//
+// Runs inside its own forked process, which is the leader of the job's
+// process group: workers join that group, so jobs/fg/bg and Ctrl+C treat
+// the whole fan-out as one job. Each worker's stdout goes to a pipe and is
+// written out in one piece once the worker is reaped, so outputs never
+// interleave; with -k they also come out in input order.
+//
+// A slot frees up when its worker exits, not when the pipe closes: what
+// the worker wrote is in the pipe by then, and a background child it left
+// holding stdout mustn't keep the slot busy. Anything such a child writes
+// later is dropped.
+
+// How often exits are checked for when a worker has no pidfd to poll
+#define PAR_REAP_POLL_MS 50
+
+typedef struct {
+    char* item;
+    char* out;
+    size_t len;
+    size_t cap;
+} par_result;
+
+typedef struct {
+    pid_t pid;
+    int fd;             // read end of the worker's stdout, -1 once closed
+    int pidfd;          // readable once the worker exits, -1 if there is none
+    size_t seq;         // position of the item in the input
+    par_result* res;
+} par_slot;
+
+typedef struct {
+    size_t jobs;
+    int keep_order;
+    int tag;
+    char** templ;       // command template, templ_len words of argv
+    size_t templ_len;
+    char** items;       // items after :::, or NULL to read stdin
+    size_t item_count;
+} par_options;
+
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int parse_options(const command* cmd, par_options* opt) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    opt->jobs = cpus > 0 ? (size_t)cpus : 1;
+    opt->keep_order = 0;
+    opt->tag = 0;
+    opt->items = NULL;
+    opt->item_count = 0;
+
+    size_t i = 1;
+    for (; i < cmd->argc && cmd->argv[i][0] == '-'; ++i) {
+        const char* arg = cmd->argv[i];
+        if (strcmp(arg, "-k") == 0) {
+            opt->keep_order = 1;
+        } else if (strcmp(arg, "--tag") == 0) {
+            opt->tag = 1;
+        } else if (strncmp(arg, "-j", 2) == 0) {
+            const char* n = arg[2] ? arg + 2 : (i + 1 < cmd->argc ? cmd->argv[++i] : NULL);
+            char* end;
+            long jobs = n ? strtol(n, &end, 10) : 0;
+            if (n == NULL || *end != '\0' || jobs <= 0) {
+                fprintf(stderr, "parallel: -j needs a positive number\n");
+                return -1;
+            }
+            opt->jobs = jobs;
+        } else if (strcmp(arg, "--") == 0) {
+            ++i;
+            break;
+        } else {
+            fprintf(stderr, "parallel: unknown option %s\n", arg);
+            return -1;
+        }
+    }
+
+    opt->templ = cmd->argv + i;
+    opt->templ_len = 0;
+    while (i < cmd->argc && strcmp(cmd->argv[i], ":::") != 0) {
+        ++opt->templ_len;
+        ++i;
+    }
+
+    if (i < cmd->argc) {
+        opt->items = cmd->argv + i + 1;
+        opt->item_count = cmd->argc - i - 1;
+    }
+
+    if (opt->templ_len == 0) {
+        fprintf(stderr, "Usage: parallel [-j N] [-k] [--tag] command [args...] [::: items...]\n");
+        return -1;
+    }
+    return 0;
+}
+
+static char* replace_braces(const char* arg, const char* item) {
+    size_t item_len = strlen(item), count = 0;
+    for (const char* p = strstr(arg, "{}"); p; p = strstr(p + 2, "{}"))
+        ++count;
+
+    char* out = malloc(strlen(arg) + count * item_len + 1);
+    if (out == NULL) return NULL;
+
+    char* w = out;
+    for (const char* p = arg; *p; ) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(w, item, item_len);
+            w += item_len;
+            p += 2;
+        } else {
+            *w++ = *p++;
+        }
+    }
+    *w = '\0';
+    return out;
+}
+
+// Substitutes every {} in the template; without any, the item is
+// appended as the last argument.
+static char** build_argv(const par_options* opt, const char* item) {
+    char** argv = calloc(opt->templ_len + 2, sizeof(char*));
+    if (argv == NULL) return NULL;
+
+    int substituted = 0;
+    for (size_t i = 0; i < opt->templ_len; ++i) {
+        if (strstr(opt->templ[i], "{}")) {
+            argv[i] = replace_braces(opt->templ[i], item);
+            substituted = 1;
+        } else {
+            argv[i] = strdup(opt->templ[i]);
+        }
+    }
+    if (!substituted)
+        argv[opt->templ_len] = strdup(item);
+    return argv;
+}
+
+static void free_argv(char** argv) {
+    for (char** a = argv; *a; ++a)
+        free(*a);
+    free(argv);
+}
+
+static int start_worker(const par_options* opt, par_slot* slot, char* item, int in_fd) {
+    par_result* res = calloc(1, sizeof(par_result));
+    if (res == NULL) {
+        perror("allocation failed");
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        free(res);
+        return -1;
+    }
+    // only our end: the worker writes to a normal blocking pipe
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    char** argv = build_argv(opt, item);
+    if (argv == NULL) {
+        perror("allocation failed");
+        close(fds[0]);
+        close(fds[1]);
+        free(res);
+        return -1;
+    }
+
+    command worker = command_default;
+    worker.argv = argv;
+    for (char** a = argv; *a; ++a) ++worker.argc;
+
+    spawn_attrs attrs = { getpgrp(), in_fd, fds[1], NULL, 0, NULL };
+    pid_t pid = spawn_external(&worker, &attrs);
+    free_argv(argv);
+    close(fds[1]);
+
+    if (pid < 0) {
+        close(fds[0]);
+        free(res);
+        return -1;
+    }
+
+    slot->pid = pid;
+    slot->fd = fds[0];
+    slot->pidfd = open_pidfd(pid);
+    if (slot->pidfd >= 0) fcntl(slot->pidfd, F_SETFD, FD_CLOEXEC);
+    slot->res = res;
+    res->item = item;
+    return 0;
+}
+
+static void emit(const par_options* opt, par_result* res) {
+    if (!opt->tag) {
+        write_all(STDOUT_FILENO, res->out, res->len);
+        return;
+    }
+
+    size_t item_len = strlen(res->item);
+    const char* p = res->out;
+    const char* end = res->out + res->len;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl + 1 : end;
+        write_all(STDOUT_FILENO, res->item, item_len);
+        write_all(STDOUT_FILENO, "\t", 1);
+        write_all(STDOUT_FILENO, p, line_end - p);
+        if (nl == NULL) write_all(STDOUT_FILENO, "\n", 1);
+        p = line_end;
+    }
+}
+
+static void free_result(par_result* res) {
+    free(res->item);
+    free(res->out);
+    free(res);
+}
+
+static void store_pending(par_result*** pending, size_t* cap, size_t seq, par_result* res) {
+    if (seq >= *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        while (new_cap <= seq) new_cap *= 2;
+        par_result** grown = realloc(*pending, new_cap * sizeof(par_result*));
+        if (grown == NULL) {
+            perror("allocation failed");
+            exit(1);
+        }
+        memset(grown + *cap, 0, (new_cap - *cap) * sizeof(par_result*));
+        *pending = grown;
+        *cap = new_cap;
+    }
+    (*pending)[seq] = res;
+}
+
+// Reads everything available; returns 1 once the output is closed
+static int drain(par_slot* slot) {
+    par_result* res = slot->res;
+    while (1) {
+        if (res->cap - res->len < BUFFER_SIZE) {
+            size_t new_cap = res->cap ? res->cap * 2 : BUFFER_SIZE * 4;
+            char* grown = realloc(res->out, new_cap);
+            if (grown == NULL) {
+                perror("allocation failed");
+                return 1;
+            }
+            res->out = grown;
+            res->cap = new_cap;
+        }
+
+        ssize_t n = read(slot->fd, res->out + res->len, res->cap - res->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno != EAGAIN;
+        }
+        if (n == 0) return 1;
+        res->len += n;
+    }
+}
+
+static void close_output(par_slot* slot) {
+    close(slot->fd);
+    slot->fd = -1;
+}
+
+// Returns 1 once the worker has exited, adding it to failed if it failed
+static int reap_worker(par_slot* slot, size_t* failed) {
+    int status;
+    pid_t w;
+    while ((w = waitpid(slot->pid, &status, WNOHANG)) < 0 && errno == EINTR);
+    if (w == 0) return 0;
+
+    if (w < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ++*failed;
+    if (slot->pidfd >= 0) close(slot->pidfd);
+    slot->pidfd = -1;
+    return 1;
+}
+
+static char* next_item(const par_options* opt, line_reader* reader, size_t* consumed) {
+    if (opt->items)
+        return *consumed < opt->item_count ? strdup(opt->items[(*consumed)++]) : NULL;
+
+    char* line;
+    while ((line = reader_next_line(reader)) != NULL) {
+        if (*line) {
+            ++*consumed;
+            return strdup(line);
+        }
+    }
+    return NULL;
+}
+
+int internal_parallel(const command* cmd) {
+    par_options opt;
+    if (parse_options(cmd, &opt) < 0)
+        return 1;
+
+    // Items read from stdin must not leak into the workers
+    line_reader reader;
+    int worker_in = -1;
+    if (opt.items == NULL) {
+        reader_open_fd(&reader, STDIN_FILENO);
+        worker_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // two pollfds a slot: the output and the pidfd
+    par_slot* slots = calloc(opt.jobs, sizeof(par_slot));
+    struct pollfd* pfds = calloc(opt.jobs * 2, sizeof(struct pollfd));
+    size_t* active = calloc(opt.jobs * 2, sizeof(size_t));
+    if (slots == NULL || pfds == NULL || active == NULL) {
+        perror("allocation failed");
+        exit(1);
+    }
+
+    // -k: finished results indexed by input position until their turn
+    par_result** pending = NULL;
+    size_t pending_cap = 0, next_emit = 0;
+
+    size_t consumed = 0, running = 0, failed = 0;
+    int exhausted = 0;
+
+    while (1) {
+        // Refill every free slot before waiting again
+        for (size_t s = 0; s < opt.jobs && running < opt.jobs && !exhausted; ++s) {
+            if (slots[s].res != NULL) continue;
+
+            size_t seq = consumed;
+            char* item = next_item(&opt, &reader, &consumed);
+            if (item == NULL) {
+                exhausted = 1;
+                break;
+            }
+            if (start_worker(&opt, &slots[s], item, worker_in) < 0) {
+                free(item);
+                ++failed;
+                if (opt.keep_order) {
+                    // keep the ordering intact: an empty result stands in
+                    par_result* empty = calloc(1, sizeof(par_result));
+                    if (empty == NULL) {
+                        perror("allocation failed");
+                        exit(1);
+                    }
+                    store_pending(&pending, &pending_cap, seq, empty);
+                }
+                continue;
+            }
+            slots[s].seq = seq;
+            ++running;
+        }
+
+        if (running == 0) break;
+
+        size_t n = 0;
+        int timeout = -1;
+        for (size_t s = 0; s < opt.jobs; ++s) {
+            if (slots[s].res == NULL) continue;
+            if (slots[s].fd >= 0) {
+                pfds[n].fd = slots[s].fd;
+                pfds[n].events = POLLIN;
+                active[n++] = s;
+            }
+            if (slots[s].pidfd >= 0) {
+                pfds[n].fd = slots[s].pidfd;
+                pfds[n].events = POLLIN;
+                active[n++] = s;
+            } else {
+                timeout = PAR_REAP_POLL_MS;
+            }
+        }
+
+        if (poll(pfds, n, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            par_slot* slot = &slots[active[i]];
+            if (pfds[i].revents != 0 && pfds[i].fd == slot->fd && drain(slot))
+                close_output(slot);
+        }
+
+        for (size_t s = 0; s < opt.jobs; ++s) {
+            par_slot* slot = &slots[s];
+            if (slot->res == NULL || !reap_worker(slot, &failed)) continue;
+
+            // whatever the worker wrote is in the pipe by now
+            if (slot->fd >= 0) {
+                drain(slot);
+                close_output(slot);
+            }
+
+            par_result* res = slot->res;
+            slot->res = NULL;
+            --running;
+
+            if (!opt.keep_order) {
+                emit(&opt, res);
+                free_result(res);
+                continue;
+            }
+
+            store_pending(&pending, &pending_cap, slot->seq, res);
+        }
+
+        while (opt.keep_order && next_emit < pending_cap && pending[next_emit]) {
+            par_result* res = pending[next_emit++];
+            if (res->item) emit(&opt, res);
+            free_result(res);
+        }
+    }
+
+    if (failed)
+        fprintf(stderr, "parallel: %zu of %zu jobs failed\n", failed, consumed);
+
+    if (opt.items == NULL) {
+        reader_close(&reader);
+        if (worker_in >= 0) close(worker_in);
+    }
+    free(pending);
+    free(active);
+    free(pfds);
+    free(slots);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+#include "../headers/parsecache.h"
+#include "../headers/parser.h"
+#include "../headers/hash.h"
+
+typedef struct {
+    arena store;     // the tree and its own copy of the text
+    uint64_t hash;
+    char* text;      // NULL for a free entry
+    node* tree;
+    unsigned long last_used;
+} parse_entry;
+
+static parse_entry entries[PARSE_CACHE_SIZE];
+static unsigned long clock_tick = 0;
+
+unsigned long parse_cache_hits = 0;
+unsigned long parse_cache_misses = 0;
+
+// A free entry, or else the least recently used one
+static parse_entry* pick_victim(void) {
+    parse_entry* victim = &entries[0];
+    for (size_t i = 0; i < PARSE_CACHE_SIZE; ++i) {
+        if (entries[i].text == NULL) return &entries[i];
+        if (entries[i].last_used < victim->last_used) victim = &entries[i];
+    }
+    return victim;
+}
+
+node* parsecache_parse(const char* text) {
+    uint64_t hash = fnv1a_str(FNV1A_SEED, text);
+    ++clock_tick;
+
+    for (size_t i = 0; i < PARSE_CACHE_SIZE; ++i) {
+        parse_entry* e = &entries[i];
+        if (e->text && e->hash == hash && strcmp(e->text, text) == 0) {
+            e->last_used = clock_tick;
+            ++parse_cache_hits;
+            parse_incomplete = 0;
+            return e->tree;
+        }
+    }
+    ++parse_cache_misses;
+
+    parse_entry* e = pick_victim();
+    arena_reset(&e->store);
+    e->text = NULL;
+
+    // parse_input works on a buffer of its own; the tree may point into it
+    char* buffer = arena_strdup(&e->store, text);
+    char* key = arena_strdup(&e->store, text);
+    if (buffer == NULL || key == NULL) return NULL;
+
+    node* tree = parse_input(&e->store, buffer);
+    if (tree == NULL) {
+        arena_reset(&e->store);
+        return NULL;
+    }
+
+    e->hash = hash;
+    e->text = key;
+    e->tree = tree;
+    e->last_used = clock_tick;
+    return tree;
+}
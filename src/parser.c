@@ -1,30 +1,42 @@
 #include "../headers/parser.h"
 #include "../headers/variables.h"
+#include "../headers/events.h"
+#include "../headers/usage.h"
+#include "../headers/trace.h"
+#include "../headers/subst.h"
+#include "../headers/execute.h"
+#include "../headers/arith.h"
+#include "../headers/internalfuncs.h"
 
 int shell_interactive = 0;
 pid_t shell_pgid = 0;
 int shell_tty = -1;
 volatile sig_atomic_t fg_pgid = 0;
-volatile sig_atomic_t child_status_changed = 0;
+volatile sig_atomic_t interrupted = 0;
+
+command command_default = {0, NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, NULL, 0, BUILTIN_UNRESOLVED};
+pipeline pipeline_default = {0, NULL, 0, 0, 0, NULL, NULL, NULL};
+int finished_jobs = 0;
+int parse_incomplete = 0;
 
 void give_terminal_to(pid_t pgid) {
     if (!shell_interactive) return;
     if (pgid <= 0) return;
+    uint64_t start = trace_now();
     tcsetpgrp(shell_tty, pgid);
+    trace_record(TRACE_TERMINAL, start, NULL);
 }
 
 void reclaim_terminal(void) {
     if (!shell_interactive) return;
+    uint64_t start = trace_now();
     tcsetpgrp(shell_tty, shell_pgid);
-}
-
-void sigchld_handler(int sig) {
-    (void)sig;
-    child_status_changed = 1;
+    trace_record(TRACE_TERMINAL, start, NULL);
 }
 
 void sigint_handler(int sig) {
     (void)sig;
+    interrupted = 1;
     pid_t pgid = fg_pgid;
     if (pgid > 0) killpg(pgid, SIGINT);
 }
@@ -52,44 +64,74 @@ void set_handler(int signo, void (*handler)(int)) {
 }
 
 void install_all_shell_handlers(void) {
-    set_handler(SIGCHLD, sigchld_handler);
-
     set_handler(SIGINT,  sigint_handler);
+    // without SA_RESTART: a builtin running in the shell and blocked in a
+    // read (cat of a fifo or /dev/tty) gets EINTR and sees interrupted
+    siginterrupt(SIGINT, 1);
     set_handler(SIGTSTP, sigtstp_handler);
 
     ignore_signal(SIGTTOU);
     ignore_signal(SIGTTIN);
+    // A reader that exits early must not kill the shell: a builtin running
+    // in process sees EPIPE and stops, as a forked one would have died.
+    // Children get SIG_DFL back before they run anything.
+    ignore_signal(SIGPIPE);
 }
 
-void check_child_status(void) {
-    if (!child_status_changed) {
+// Moves a process of a known job to a new JOB_* state
+void handle_child_state(pid_t pid, int state) {
+    process* proc = find_process(pid);
+    if (proc == NULL) {
         return;
     }
-    
-    child_status_changed = 0;
-    
-    int status;
-    pid_t pid;
-    
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        pid_t pgid = get_pgid_of_process(pid);
-        if (pgid == -1) {
-            continue; 
-        }
-        
-        job_t* job = find_job_by_pgid(pgid);
-        if (job == NULL) {
-            continue;
+
+    update_process_status(proc, state);
+
+    if (state == JOB_DONE) {
+        forget_process(proc);
+        if (proc->job->status == JOB_DONE) {
+            usage_log_job(proc->job);
+            if (proc->job->job_id > 0)
+                finished_jobs++;
         }
+    }
+}
+
+void handle_child_status(pid_t pid, int status, const struct rusage* usage) {
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        process* proc = find_process(pid);
+        if (proc)
+            record_process_exit(proc, status, usage);
+        handle_child_state(pid, JOB_DONE);
+    } else if (WIFSTOPPED(status)) {
+        handle_child_state(pid, JOB_STOPPED);
+    } else if (WIFCONTINUED(status)) {
+        handle_child_state(pid, JOB_RUNNING);
+    }
+}
 
-        if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            update_job_status(job, pid, JOB_DONE);
-        } else if (WIFSTOPPED(status)) {
-            update_job_status(job, pid, JOB_STOPPED);
-        } else if (WIFCONTINUED(status)) {
-            update_job_status(job, pid, JOB_RUNNING);
+// Finished background jobs are announced once (interactive only) and dropped
+void report_finished_jobs(void) {
+    if (finished_jobs == 0) return;
+    finished_jobs = 0;
+
+    job_t* job = job_list;
+    while (job) {
+        job_t* next = job->next;
+        if (job->status == JOB_DONE && job->job_id > 0) {
+            if (shell_interactive)
+                printf("[%d]+  Done\t%s\n", job->job_id, job->command_line);
+            remove_job(job->job_id);
         }
+        job = next;
     }
+    fflush(stdout);
+}
+
+void check_child_status(void) {
+    while (events_dispatch(0) > 0)
+        ;
+    report_finished_jobs();
 }
 
 void setup_child_signals_and_pgrp(pid_t pg_leader_pgid, int is_fg) {
@@ -99,6 +141,8 @@ void setup_child_signals_and_pgrp(pid_t pg_leader_pgid, int is_fg) {
     signal(SIGTTOU, SIG_DFL);
     signal(SIGTTIN, SIG_DFL);
     signal(SIGCHLD, SIG_DFL);
+    // the shell ignores it
+    signal(SIGPIPE, SIG_DFL);
 
     if (pg_leader_pgid == 0) {
         setpgid(0, 0);
@@ -108,115 +152,640 @@ void setup_child_signals_and_pgrp(pid_t pg_leader_pgid, int is_fg) {
 
 }
 
-command* parse_cmd(char* cmd_as_string, size_t max_args) {
-    command* new_cmd = (command*)malloc(sizeof(command));
+// Input that stops where more must follow (an open if, a trailing |) is
+// not reported here: the caller may have another line to append.
+static void syntax_error(const token* tok) {
+    if (tok->type == TOK_END) {
+        parse_incomplete = 1;
+        return;
+    }
+    const char* text = token_name(tok->type);
+    if (tok->type == TOK_WORD && tok->w.parts)
+        text = tok->w.parts->text;
+    fprintf(stderr, "syntax error near unexpected token `%s'\n", text);
+}
+
+// A lexer error has its own message; anything else is an unexpected token
+static void parse_error(const lexer* lx, const token* tok) {
+    if (tok->type != TOK_ERROR)
+        syntax_error(tok);
+    else if (lx->incomplete)
+        parse_incomplete = 1;
+    else
+        fprintf(stderr, "%s\n", lx->error);
+}
+
+void report_incomplete(void) {
+    fprintf(stderr, "syntax error: unexpected end of file\n");
+}
+
+// Substitutes the variables and commands of a word; literal words come
+// back as they are
+char* expand_word(arena* a, const word* w) {
+    if (w->literal)
+        return w->literal;
+
+    size_t count = 0;
+    for (word_part* part = w->parts; part; part = part->next)
+        ++count;
+
+    // a command must run exactly once, so every part is resolved up front
+    const char** values = arena_alloc(a, count * sizeof(char*));
+    size_t* lens = arena_alloc(a, count * sizeof(size_t));
+    if (values == NULL || lens == NULL) return NULL;
+
+    size_t len = 0, i = 0;
+    for (word_part* part = w->parts; part; part = part->next, ++i) {
+        if (part->type == PART_VAR && part->text[0] == '?') {
+            char* status = arena_alloc(a, 16);
+            if (status == NULL) return NULL;
+            snprintf(status, 16, "%d", last_status);
+            values[i] = status;
+            lens[i] = strlen(status);
+        } else if (part->type == PART_VAR) {
+            values[i] = get_var(part->text);
+            if (values[i] == NULL) {
+                fprintf(stderr, "no variable with this name\n");
+                return NULL;
+            }
+            lens[i] = strlen(values[i]);
+        } else if (part->type == PART_ARITH) {
+            long long value;
+            char* text = arena_alloc(a, ARITH_TEXT_SIZE);
+            if (text == NULL || arith_eval(part->text, &value) < 0) return NULL;
+            values[i] = text;
+            lens[i] = arith_format(value, text);
+        } else if (part->type == PART_COMMAND) {
+            values[i] = command_substitution(a, part->text);
+            if (values[i] == NULL) return NULL;
+            lens[i] = strlen(values[i]);
+        } else {
+            values[i] = part->text;
+            lens[i] = part->len;
+        }
+        len += lens[i];
+    }
+
+    char* result = arena_alloc(a, len + 1);
+    if (result == NULL) return NULL;
+
+    char* out = result;
+    for (i = 0; i < count; ++i) {
+        memcpy(out, values[i], lens[i]);
+        out += lens[i];
+    }
+    *out = '\0';
+    return result;
+}
+
+int expand_command(arena* a, command* cmd) {
+    // a group keeps the argv it was given by the parser
+    if (cmd->body == NULL) {
+        char** argv = arena_alloc(a, (cmd->wordc + 1) * sizeof(char*));
+        if (argv == NULL) return -1;
+
+        for (size_t i = 0; i < cmd->wordc; ++i) {
+            argv[i] = expand_word(a, &cmd->words[i]);
+            if (argv[i] == NULL) return -1;
+        }
+        argv[cmd->wordc] = NULL;
+        cmd->argv = argv;
+        cmd->argc = cmd->wordc;
+    }
+
+    cmd->redirectInput = NULL;
+    cmd->redirectOutput = NULL;
+    if (cmd->inputWord && (cmd->redirectInput = expand_word(a, cmd->inputWord)) == NULL)
+        return -1;
+    if (cmd->outputWord && (cmd->redirectOutput = expand_word(a, cmd->outputWord)) == NULL)
+        return -1;
+    return 0;
+}
+
+// The word as an unquoted keyword such as '{' or 'time'
+static int is_keyword(const token* tok, const char* keyword) {
+    return tok->type == TOK_WORD && tok->w.literal && !tok->w.quoted
+           && strcmp(tok->w.literal, keyword) == 0;
+}
+
+// Words that close a list. They are only reserved where a command starts,
+// so 'echo done' still prints done.
+static const char* const closing_keywords[] = {
+    "}", "then", "elif", "else", "fi", "do", "done", "esac", NULL
+};
+
+static int ends_list(const token* tok) {
+    if (tok->type == TOK_END || tok->type == TOK_RPAREN || tok->type == TOK_DSEMI)
+        return 1;
+    for (int i = 0; closing_keywords[i]; ++i)
+        if (is_keyword(tok, closing_keywords[i])) return 1;
+    return 0;
+}
+
+static int starts_compound(const token* tok) {
+    return tok->type == TOK_LPAREN || is_keyword(tok, "{") || is_keyword(tok, "if")
+           || is_keyword(tok, "while") || is_keyword(tok, "until")
+           || is_keyword(tok, "for") || is_keyword(tok, "case");
+}
+
+static void skip_newlines(lexer* lx, token* tok) {
+    while (tok->type == TOK_NEWLINE)
+        lexer_next(lx, tok);
+}
+
+// Consumes the keyword that has to come next
+static int expect_keyword(lexer* lx, token* tok, const char* keyword) {
+    if (!is_keyword(tok, keyword)) {
+        parse_error(lx, tok);
+        return -1;
+    }
+    lexer_next(lx, tok);
+    return 0;
+}
+
+// The source between two tokens, for job listings
+static char* source_text(arena* a, const char* start, const char* end) {
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n'))
+        --end;
+    return arena_strndup(a, start, end - start);
+}
+
+static word* copy_word(arena* a, const word* w) {
+    word* copy = arena_alloc(a, sizeof(word));
+    if (copy) *copy = *w;
+    return copy;
+}
+
+// Appends w to an arena array of words, doubling it when full
+static word* push_word(arena* a, word* words, size_t* count, size_t* capacity, const word* w) {
+    if (*count == *capacity) {
+        words = arena_grow(a, words, *capacity * sizeof(word), 2 * *capacity * sizeof(word));
+        if (words == NULL) return NULL;
+        *capacity *= 2;
+    }
+    words[(*count)++] = *w;
+    return words;
+}
+
+// A redirection operator in tok; reads its target word
+static int parse_redirect(arena* a, lexer* lx, token* tok, command* cmd) {
+    token_type redirect = tok->type;
+
+    if (lexer_next(lx, tok) != TOK_WORD) {
+        if (tok->type == TOK_ERROR) {
+            parse_error(lx, tok);
+            return -1;
+        }
+        fprintf(stderr, "no filename after %s\n", token_name(redirect));
+        return -1;
+    }
+
+    word* target = copy_word(a, &tok->w);
+    if (target == NULL) return -1;
+
+    if (redirect == TOK_REDIR_IN) {
+        cmd->inputWord = target;
+    } else {
+        cmd->outputWord = target;
+        cmd->appendOutput = (redirect == TOK_REDIR_APPEND);
+    }
+    return 0;
+}
+
+static int is_redirect(const token* tok) {
+    return tok->type == TOK_REDIR_IN || tok->type == TOK_REDIR_OUT
+           || tok->type == TOK_REDIR_APPEND;
+}
+
+// Reads words and redirections up to the next operator, which is left in tok
+command* parse_cmd(arena* a, lexer* lx, token* tok) {
+    command* new_cmd = arena_alloc(a, sizeof(command));
     
     if (new_cmd == NULL) {
-        perror("allocation failed");
         return NULL;
     }
 
     *new_cmd = command_default;
 
-    char* curr_token;
-    char* tokens[MAX_ARGS];
-    char* saveptr;
-    size_t counter = 0;
+    size_t capacity = 8;
+    word* words = arena_alloc(a, capacity * sizeof(word));
+    if (words == NULL) return NULL;
+
+    int has_redirect = 0;
+
+    while (1) {
+        if (tok->type == TOK_WORD) {
+            words = push_word(a, words, &new_cmd->wordc, &capacity, &tok->w);
+            if (words == NULL) return NULL;
+        }
+        else if (is_redirect(tok)) {
+            if (parse_redirect(a, lx, tok, new_cmd) < 0) return NULL;
+            has_redirect = 1;
+        }
+        else if (tok->type == TOK_ERROR) {
+            parse_error(lx, tok);
+            return NULL;
+        }
+        else {
+            break;
+        }
+
+        lexer_next(lx, tok);
+    }
+
+    if (new_cmd->wordc == 0 && !has_redirect) {
+        syntax_error(tok);
+        return NULL;
+    }
+
+    new_cmd->words = words;
+    if (new_cmd->wordc > 0 && words[0].literal)
+        new_cmd->builtin = resolve_builtin(words[0].literal);
+    return new_cmd;
+}
+
+static node* parse_list(arena* a, lexer* lx, token* tok);
+
+static node* new_node(arena* a, node_type type, node* left, node* right) {
+    node* n = arena_alloc(a, sizeof(node));
+    if (n == NULL) return NULL;
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    return n;
+}
+
+// do list done
+static node* parse_do_group(arena* a, lexer* lx, token* tok) {
+    if (expect_keyword(lx, tok, "do") < 0) return NULL;
+    node* body = parse_list(a, lx, tok);
+    if (body == NULL || expect_keyword(lx, tok, "done") < 0) return NULL;
+    return body;
+}
+
+// if list then list [elif list then list]... [else list] fi, with tok on
+// the 'if' or 'elif'. An elif becomes an if in the else branch.
+static node* parse_if(arena* a, lexer* lx, token* tok) {
+    lexer_next(lx, tok);
+    node* cond = parse_list(a, lx, tok);
+    if (cond == NULL || expect_keyword(lx, tok, "then") < 0) return NULL;
+
+    node* then = parse_list(a, lx, tok);
+    if (then == NULL) return NULL;
 
-    curr_token = strtok_r(cmd_as_string, " \t", &saveptr);
-    while (curr_token && counter < max_args - 1) {
-        tokens[counter++] = curr_token;
-        curr_token = strtok_r(NULL, " \t", &saveptr);
+    node* n = new_node(a, NODE_IF, cond, then);
+    if (n == NULL) return NULL;
+
+    if (is_keyword(tok, "elif")) {
+        n->alternative = parse_if(a, lx, tok);
+        return n->alternative ? n : NULL;
+    }
+    if (is_keyword(tok, "else")) {
+        lexer_next(lx, tok);
+        n->alternative = parse_list(a, lx, tok);
+        if (n->alternative == NULL) return NULL;
     }
+    if (expect_keyword(lx, tok, "fi") < 0) return NULL;
+    return n;
+}
 
-    for (size_t i = 0; i < counter; ++i) {
-        if (tokens[i][0] == '$') {
-            char* temp = tokens[i];
+// while list do list done, or until
+static node* parse_loop(arena* a, lexer* lx, token* tok) {
+    node_type type = is_keyword(tok, "while") ? NODE_WHILE : NODE_UNTIL;
+    lexer_next(lx, tok);
 
-            tokens[i] = get_var(temp + 1);
+    node* cond = parse_list(a, lx, tok);
+    if (cond == NULL) return NULL;
+    node* body = parse_do_group(a, lx, tok);
+    if (body == NULL) return NULL;
+    return new_node(a, type, cond, body);
+}
 
-            if (tokens[i] == NULL) {
-                fprintf(stderr, "no variable with this name\n");
-                return NULL;
-            }
+static int is_name(const char* s) {
+    if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_'))
+        return 0;
+    for (++s; *s; ++s)
+        if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') || *s == '_'))
+            return 0;
+    return 1;
+}
+
+// for name [in word...] ; do list done
+static node* parse_for(arena* a, lexer* lx, token* tok) {
+    lexer_next(lx, tok);
+    if (tok->type != TOK_WORD || tok->w.literal == NULL || tok->w.quoted || !is_name(tok->w.literal)) {
+        if (tok->type == TOK_WORD)
+            fprintf(stderr, "for: `%s': not a valid identifier\n", tok->w.parts->text);
+        else
+            parse_error(lx, tok);
+        return NULL;
+    }
+
+    node* n = new_node(a, NODE_FOR, NULL, NULL);
+    if (n == NULL) return NULL;
+    n->name = tok->w.literal;
+
+    lexer_next(lx, tok);
+    skip_newlines(lx, tok);
+
+    if (is_keyword(tok, "in")) {
+        size_t capacity = 8;
+        n->words = arena_alloc(a, capacity * sizeof(word));
+        if (n->words == NULL) return NULL;
+
+        while (lexer_next(lx, tok) == TOK_WORD) {
+            n->words = push_word(a, n->words, &n->wordc, &capacity, &tok->w);
+            if (n->words == NULL) return NULL;
+        }
+        if (tok->type != TOK_SEMI && tok->type != TOK_NEWLINE) {
+            parse_error(lx, tok);
+            return NULL;
         }
+        lexer_next(lx, tok);
+    } else if (tok->type == TOK_SEMI) {
+        lexer_next(lx, tok);
+    }
+    skip_newlines(lx, tok);
 
-        if (strcmp(tokens[i], "<") == 0) {
-            if (i + 1 == counter) {
-                fprintf(stderr, "no filename after <\n");
-                return NULL;
-            }
-            
-            new_cmd->redirectInput = tokens[i + 1];
-            new_cmd->appendOutput = 0;
-            i++;
-        }
-        else if (strcmp(tokens[i], ">") == 0) {
-            if (i + 1 == counter) {
-                fprintf(stderr, "no filename after >\n");
-                return NULL;
-            }
-            new_cmd->redirectOutput = tokens[i + 1];
-            new_cmd->appendOutput = 0;
-            i++;
+    n->right = parse_do_group(a, lx, tok);
+    return n->right ? n : NULL;
+}
+
+// case word in [(] pattern [| pattern]... ) list ;; ... esac
+static node* parse_case(arena* a, lexer* lx, token* tok) {
+    if (lexer_next(lx, tok) != TOK_WORD) {
+        parse_error(lx, tok);
+        return NULL;
+    }
+
+    node* n = new_node(a, NODE_CASE, NULL, NULL);
+    if (n == NULL) return NULL;
+    n->words = copy_word(a, &tok->w);
+    n->wordc = 1;
+    if (n->words == NULL) return NULL;
+
+    lexer_next(lx, tok);
+    skip_newlines(lx, tok);
+    if (expect_keyword(lx, tok, "in") < 0) return NULL;
+    skip_newlines(lx, tok);
+
+    size_t capacity = 4;
+    n->items = arena_alloc(a, capacity * sizeof(case_item));
+    if (n->items == NULL) return NULL;
+
+    while (!is_keyword(tok, "esac")) {
+        if (n->itemc == capacity) {
+            n->items = arena_grow(a, n->items, capacity * sizeof(case_item), 2 * capacity * sizeof(case_item));
+            if (n->items == NULL) return NULL;
+            capacity *= 2;
         }
-        else if (strcmp(tokens[i], ">>") == 0) {
-            if (i + 1 == counter) {
-                fprintf(stderr, "no filename after >>\n");
+        case_item* item = &n->items[n->itemc++];
+        memset(item, 0, sizeof(*item));
+
+        if (tok->type == TOK_LPAREN)
+            lexer_next(lx, tok);
+
+        size_t pattern_capacity = 2;
+        item->patterns = arena_alloc(a, pattern_capacity * sizeof(word));
+        if (item->patterns == NULL) return NULL;
+        while (1) {
+            if (tok->type != TOK_WORD) {
+                parse_error(lx, tok);
                 return NULL;
             }
-            new_cmd->redirectOutput = tokens[i + 1];
-            new_cmd->appendOutput = 1;
-            i++;
+            item->patterns = push_word(a, item->patterns, &item->patternc, &pattern_capacity, &tok->w);
+            if (item->patterns == NULL) return NULL;
+            if (lexer_next(lx, tok) != TOK_PIPE) break;
+            lexer_next(lx, tok);
         }
-        else {
-            new_cmd->argv[new_cmd->argc++] = tokens[i];
+        if (tok->type != TOK_RPAREN) {
+            parse_error(lx, tok);
+            return NULL;
         }
-    }
+        lexer_next(lx, tok);
+        skip_newlines(lx, tok);
 
-    new_cmd->argv[new_cmd->argc] = NULL;
-    return new_cmd;
+        if (!ends_list(tok)) {
+            item->body = parse_list(a, lx, tok);
+            if (item->body == NULL) return NULL;
+        }
+
+        if (tok->type == TOK_DSEMI) {
+            lexer_next(lx, tok);
+            skip_newlines(lx, tok);
+        } else if (!is_keyword(tok, "esac")) {
+            parse_error(lx, tok);
+            return NULL;
+        }
+    }
+    lexer_next(lx, tok);
+    return n;
 }
 
-pipeline* parse_input(char* buffer, size_t max_cmds) {
-    if (!buffer) return NULL;
+// { list } and the if/while/until/for/case commands run in the shell,
+// ( list ) in a process of its own. Any of them can take redirections
+// after the word that closes it.
+static command* parse_compound(arena* a, lexer* lx, token* tok) {
+    int subshell = (tok->type == TOK_LPAREN);
+    // a name for job listings and time reports
+    char* name = subshell ? "(" : tok->w.literal;
+    node* body;
+
+    if (subshell || strcmp(name, "{") == 0) {
+        lexer_next(lx, tok);
+        body = parse_list(a, lx, tok);
+        if (body == NULL) return NULL;
+
+        if (subshell ? tok->type != TOK_RPAREN : !is_keyword(tok, "}")) {
+            parse_error(lx, tok);
+            return NULL;
+        }
+        lexer_next(lx, tok);
+    } else if (strcmp(name, "if") == 0) {
+        body = parse_if(a, lx, tok);
+    } else if (strcmp(name, "for") == 0) {
+        body = parse_for(a, lx, tok);
+    } else if (strcmp(name, "case") == 0) {
+        body = parse_case(a, lx, tok);
+    } else {
+        body = parse_loop(a, lx, tok);
+    }
+    if (body == NULL) return NULL;
+
+    command* cmd = arena_alloc(a, sizeof(command));
+    char** argv = arena_alloc(a, 2 * sizeof(char*));
+    if (cmd == NULL || argv == NULL) return NULL;
+
+    *cmd = command_default;
+    cmd->body = body;
+    cmd->subshell = subshell;
+    cmd->builtin = BUILTIN_NONE;
+    argv[0] = name;
+    argv[1] = NULL;
+    cmd->argv = argv;
+    cmd->argc = 1;
+
+    while (is_redirect(tok)) {
+        if (parse_redirect(a, lx, tok, cmd) < 0) return NULL;
+        lexer_next(lx, tok);
+    }
+    return cmd;
+}
 
-    pipeline* new_pipeline = (pipeline*)malloc(sizeof(pipeline));
+static node* parse_pipeline(arena* a, lexer* lx, token* tok) {
+    pipeline* new_pipeline = arena_alloc(a, sizeof(pipeline));
     if (new_pipeline == NULL) { 
-        perror("malloc"); 
         return NULL; 
     }
-    memset(new_pipeline, 0, sizeof(*new_pipeline));
+    *new_pipeline = pipeline_default;
+
+    node* n = new_node(a, NODE_PIPELINE, NULL, NULL);
+    if (n == NULL) return NULL;
+    n->pipeline = new_pipeline;
 
-    new_pipeline->buffer = strdup(buffer);
-    if (new_pipeline->buffer == NULL) { 
-        perror("strdup"); 
-        free(new_pipeline); 
-        return NULL; }
+    const char* start = tok->start;
 
-    char* saveptr = NULL;
-    char* token = strtok_r(new_pipeline->buffer, "|", &saveptr);
+    // 'time' is a keyword: it applies to the whole pipeline
+    if (is_keyword(tok, "time")) {
+        new_pipeline->timed = 1;
+        if (lexer_next(lx, tok) == TOK_END || tok->type == TOK_NEWLINE) {
+            new_pipeline->buffer = source_text(a, start, tok->start);
+            return n;
+        }
+    }
 
-    while (token && new_pipeline->cmdc < max_cmds) {
-        while (*token == ' ' || *token == '\t')
-            token++;
-        
-        command* cmd = parse_cmd(token, MAX_ARGS);
+    // Leading pipe settings apply to this pipeline only
+    while (tok->type == TOK_WORD && tok->w.literal) {
+        if (strncmp(tok->w.literal, "PIPE_CAPACITY=", 14) == 0)
+            new_pipeline->pipe_capacity = tok->w.literal + 14;
+        else if (strncmp(tok->w.literal, "PIPE_PACKET=", 12) == 0)
+            new_pipeline->pipe_packet = tok->w.literal + 12;
+        else
+            break;
+        // a setting with no command after it is an error, not unfinished input
+        if (lexer_next(lx, tok) == TOK_END) {
+            fprintf(stderr, "syntax error near unexpected token `%s'\n", token_name(TOK_END));
+            return NULL;
+        }
+    }
+
+    size_t capacity = 4;
+    new_pipeline->cmds = arena_alloc(a, capacity * sizeof(command*));
+    if (new_pipeline->cmds == NULL) {
+        return NULL;
+    }
+
+    while (1) {
+        command* cmd = starts_compound(tok) ? parse_compound(a, lx, tok) : parse_cmd(a, lx, tok);
         if (!cmd) { 
-            free_pipeline_mem(new_pipeline); 
             return NULL; 
         }
+
+        if (new_pipeline->cmdc == capacity) {
+            new_pipeline->cmds = arena_grow(a, new_pipeline->cmds, capacity * sizeof(command*),
+                                            2 * capacity * sizeof(command*));
+            if (new_pipeline->cmds == NULL) return NULL;
+            capacity *= 2;
+        }
         new_pipeline->cmds[new_pipeline->cmdc++] = cmd;
-        token = strtok_r(NULL, "|", &saveptr);
+
+        if (tok->type != TOK_PIPE)
+            break;
+        lexer_next(lx, tok);
+        skip_newlines(lx, tok);
+    }
+
+    new_pipeline->buffer = source_text(a, start, tok->start);
+    if (new_pipeline->buffer == NULL) return NULL;
+    return n;
+}
+
+// pipeline { && pipeline | || pipeline }, grouped from the left
+static node* parse_and_or(arena* a, lexer* lx, token* tok) {
+    node* left = parse_pipeline(a, lx, tok);
+
+    while (left && (tok->type == TOK_AND || tok->type == TOK_OR)) {
+        node_type type = (tok->type == TOK_AND) ? NODE_AND : NODE_OR;
+        lexer_next(lx, tok);
+        skip_newlines(lx, tok);
+
+        node* right = parse_pipeline(a, lx, tok);
+        if (right == NULL) return NULL;
+        left = new_node(a, type, left, right);
     }
+    return left;
+}
 
-    if (new_pipeline->cmdc == 0) 
-        return new_pipeline; 
+// and/or lists separated by ';', '&' or newlines, up to the end of the
+// input or the token that closes the enclosing command
+static node* parse_list(arena* a, lexer* lx, token* tok) {
+    node* list = NULL;
+
+    skip_newlines(lx, tok);
+    while (!ends_list(tok)) {
+        const char* start = tok->start;
+        node* item = parse_and_or(a, lx, tok);
+        if (item == NULL) return NULL;
+
+        if (tok->type == TOK_BACKGROUND) {
+            if (item->type == NODE_PIPELINE) {
+                item->pipeline->background = 1;
+            } else {
+                item->background = 1;
+                item->text = source_text(a, start, tok->start);
+            }
+            lexer_next(lx, tok);
+        } else if (tok->type == TOK_SEMI || tok->type == TOK_NEWLINE) {
+            lexer_next(lx, tok);
+        } else if (!ends_list(tok)) {
+            parse_error(lx, tok);
+            return NULL;
+        }
+        skip_newlines(lx, tok);
 
-    command* last = new_pipeline->cmds[new_pipeline->cmdc - 1];
-    if (last->argc > 0 && strcmp(last->argv[last->argc - 1], "&") == 0) {
-        last->argv[--last->argc] = NULL;
-        new_pipeline->background = 1;
+        list = list ? new_node(a, NODE_SEQUENCE, list, item) : item;
+        if (list == NULL) return NULL;
+    }
+
+    if (list == NULL) {
+        parse_error(lx, tok);
+        return NULL;
     }
-    return new_pipeline;
-}
\ No newline at end of file
+    return list;
+}
+
+// One pass over the input: the lexer hands out typed tokens and the tree
+// is built as they arrive. Words are expanded later, as each command runs.
+node* parse_input(arena* a, char* buffer) {
+    parse_incomplete = 0;
+    if (!buffer) return NULL;
+
+    lexer lx;
+    token tok;
+    lexer_init(&lx, a, buffer);
+
+    lexer_next(&lx, &tok);
+    skip_newlines(&lx, &tok);
+
+    // blank or comment-only input: an empty pipeline
+    if (tok.type == TOK_END) {
+        node* n = new_node(a, NODE_PIPELINE, NULL, NULL);
+        pipeline* p = arena_alloc(a, sizeof(pipeline));
+        if (n == NULL || p == NULL) return NULL;
+        *p = pipeline_default;
+        p->buffer = "";
+        n->pipeline = p;
+        return n;
+    }
+
+    node* tree = parse_list(a, &lx, &tok);
+    if (tree == NULL) return NULL;
+
+    // a closing word or token nothing opened
+    if (tok.type != TOK_END) {
+        syntax_error(&tok);
+        return NULL;
+    }
+    return tree;
+}
@@ -0,0 +1,200 @@
+#include "../headers/pathcache.h"
+#include "../headers/variables.h"
+#include "../headers/hash.h"
+
+#define PATH_CACHE_MIN_BUCKETS 64
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+static path_entry_t** buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+
+unsigned long path_cache_hits = 0;
+unsigned long path_cache_misses = 0;
+
+static int grow_buckets(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : PATH_CACHE_MIN_BUCKETS;
+    path_entry_t** new_buckets = calloc(new_count, sizeof(path_entry_t*));
+    if (new_buckets == NULL) {
+        perror("allocation failed");
+        return -1;
+    }
+
+    for (size_t i = 0; i < bucket_count; ++i) {
+        path_entry_t* e = buckets[i];
+        while (e) {
+            path_entry_t* next = e->next;
+            size_t b = fnv1a_str(FNV1A_SEED, e->name) & (new_count - 1);
+            e->next = new_buckets[b];
+            new_buckets[b] = e;
+            e = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+static path_entry_t* find_entry(const char* name) {
+    if (bucket_count == 0) return NULL;
+
+    path_entry_t* e = buckets[fnv1a_str(FNV1A_SEED, name) & (bucket_count - 1)];
+    while (e) {
+        if (strcmp(e->name, name) == 0)
+            return e;
+        e = e->next;
+    }
+    return NULL;
+}
+
+static int is_executable_file(const char* path) {
+    struct stat st;
+    if (stat(path, &st) < 0) return 0;
+    if (!S_ISREG(st.st_mode)) return 0;
+    return access(path, X_OK) == 0;
+}
+
+// Same search execvp would do, but stat-probing instead of trying execve
+static char* resolve_in_path(const char* name) {
+    const char* path = get_var("PATH");
+    if (path == NULL) path = DEFAULT_PATH;
+
+    size_t name_len = strlen(name);
+    const char* dir = path;
+
+    while (1) {
+        const char* end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        char candidate[PATH_MAX];
+        if (dir_len + name_len + 2 <= sizeof(candidate)) {
+            if (dir_len == 0) {
+                // empty PATH component means the current directory
+                memcpy(candidate, name, name_len + 1);
+            } else {
+                memcpy(candidate, dir, dir_len);
+                candidate[dir_len] = '/';
+                memcpy(candidate + dir_len + 1, name, name_len + 1);
+            }
+
+            if (is_executable_file(candidate))
+                return strdup(candidate);
+        }
+
+        if (!end) break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+static path_entry_t* insert_entry(const char* name, char* resolved) {
+    if (entry_count >= bucket_count && grow_buckets() < 0) {
+        free(resolved);
+        return NULL;
+    }
+
+    path_entry_t* e = malloc(sizeof(path_entry_t));
+    if (e == NULL) {
+        perror("allocation failed");
+        free(resolved);
+        return NULL;
+    }
+
+    e->name = strdup(name);
+    e->path = resolved;
+    e->hits = 0;
+
+    size_t b = fnv1a_str(FNV1A_SEED, name) & (bucket_count - 1);
+    e->next = buckets[b];
+    buckets[b] = e;
+    entry_count++;
+    return e;
+}
+
+const char* pathcache_lookup(const char* name) {
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    path_entry_t* e = find_entry(name);
+    if (e) {
+        path_cache_hits++;
+        e->hits++;
+        return e->path;
+    }
+
+    path_cache_misses++;
+    char* resolved = resolve_in_path(name);
+    if (resolved == NULL)
+        return NULL;
+
+    e = insert_entry(name, resolved);
+    if (e == NULL)
+        return NULL;
+
+    e->hits++;
+    return e->path;
+}
+
+int pathcache_warm(const char* name) {
+    if (strchr(name, '/') != NULL || find_entry(name) != NULL)
+        return 0;
+
+    char* resolved = resolve_in_path(name);
+    if (resolved == NULL)
+        return -1;
+
+    return insert_entry(name, resolved) ? 0 : -1;
+}
+
+void pathcache_forget(const char* name) {
+    if (bucket_count == 0) return;
+
+    path_entry_t** link = &buckets[fnv1a_str(FNV1A_SEED, name) & (bucket_count - 1)];
+    while (*link) {
+        path_entry_t* e = *link;
+        if (strcmp(e->name, name) == 0) {
+            *link = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            entry_count--;
+            return;
+        }
+        link = &e->next;
+    }
+}
+
+void pathcache_clear(void) {
+    for (size_t i = 0; i < bucket_count; ++i) {
+        path_entry_t* e = buckets[i];
+        while (e) {
+            path_entry_t* next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    entry_count = 0;
+}
+
+void pathcache_print(void) {
+    if (entry_count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < bucket_count; ++i) {
+        for (path_entry_t* e = buckets[i]; e; e = e->next)
+            printf("%4lu\t%s\n", e->hits, e->path);
+    }
+}
+
+void pathcache_print_stats(void) {
+    printf("entries: %zu  hits: %lu  misses: %lu\n",
+           entry_count, path_cache_hits, path_cache_misses);
+}
@@ -1,20 +1,57 @@
 #include "../headers/proc.h"
+#include "../headers/usage.h"
+#include "../headers/trace.h"
+#include "../headers/table.h"
 
 job_t* job_list = NULL;
 int last_id = 0;
 
-process* global_process_list[MAX_GLOBAL_PROCESSES];
-int global_process_counter = 0;
+// A pid, pgid or job id (always > 0) to its record
+typedef struct {
+    uint64_t key;
+    void* value;
+} pid_slot;
+
+static hash_table process_index = TABLE_INIT(pid_slot);  // pid  -> process*
+static hash_table job_pgid_index = TABLE_INIT(pid_slot); // pgid -> job_t*
+static hash_table job_id_index = TABLE_INIT(pid_slot);   // id   -> job_t*
+
+static void* index_get(const hash_table* idx, pid_t key) {
+    pid_slot* slot = table_find(idx, (uint64_t)key, NULL, NULL);
+    return slot ? slot->value : NULL;
+}
+
+static int index_put(hash_table* idx, pid_t key, void* value) {
+    pid_slot* slot = table_insert(idx, (uint64_t)key, NULL, NULL);
+    if (slot == NULL) return -1;
+    slot->value = value;
+    return 0;
+}
+
+static void index_remove(hash_table* idx, pid_t key) {
+    pid_slot* slot = table_find(idx, (uint64_t)key, NULL, NULL);
+    if (slot) table_remove(idx, slot);
+}
 
 pid_t get_pgid_of_process(pid_t pid) {
-    for (int i = 0; i < global_process_counter; ++i)
-        if (global_process_list[i]->pid == pid)
-            return global_process_list[i]->pgid;
+    process* proc = index_get(&process_index, pid);
+    return proc ? proc->pgid : -1;
+}
 
+process* find_process(pid_t pid) {
+    return index_get(&process_index, pid);
 }
 
-job_t* add_job(pid_t pgid, const char* command_line, struct pipeline* p) {
-    job_t* new_job = (job_t*)malloc(sizeof(job_t));
+// Once a process is reaped its pid can be handed out again
+void forget_process(process* proc) {
+    if (index_get(&process_index, proc->pid) == proc)
+        index_remove(&process_index, proc->pid);
+}
+
+// Foreground jobs are tracked like any other but have no job id (0) and
+// stay out of 'jobs' unless they get stopped.
+job_t* add_foreground_job(pid_t pgid, const char* command_line) {
+    job_t* new_job = (job_t*)calloc(1, sizeof(job_t));
     
     if (new_job == NULL) {
         perror("allocation failed");
@@ -23,92 +60,164 @@ job_t* add_job(pid_t pgid, const char* command_line, struct pipeline* p) {
     new_job->pgid = pgid;
     new_job->command_line = strdup(command_line);
     new_job->status = JOB_RUNNING;
+    clock_gettime(CLOCK_MONOTONIC, &new_job->started);
 
     new_job->process_counter = 0;
 
     new_job->next = job_list;
+    if (job_list)
+        job_list->prev = new_job;
     job_list = new_job;
-    new_job->job_id = ++last_id;
+
+    index_put(&job_pgid_index, pgid, new_job);
 
     return new_job;
 }
 
+void assign_job_id(job_t* job) {
+    if (job->job_id > 0) return;
+
+    job->job_id = ++last_id;
+    index_put(&job_id_index, job->job_id, job);
+}
+
+job_t* add_job(pid_t pgid, const char* command_line, struct pipeline* p) {
+    job_t* new_job = add_foreground_job(pgid, command_line);
+    if (new_job != NULL)
+        assign_job_id(new_job);
+    return new_job;
+}
+
 job_t* find_job_by_id(int job_id) {
-    job_t* current = job_list;
-    while (current) {
-        if (current->job_id == job_id)
-            return current;
-        current = current->next;
-    }
-    return NULL;
+    if (job_id <= 0) return NULL;
+    return index_get(&job_id_index, job_id);
 }
 
 job_t* find_job_by_pgid(pid_t pgid) {
-    job_t* current = job_list;
-    while (current) {
-        if (current->pgid == pgid)
-            return current;
-        current = current->next;
-    }
-    return NULL;
+    if (pgid <= 0) return NULL;
+    return index_get(&job_pgid_index, pgid);
 }
 
-void add_process_to_job(pid_t pgid, pid_t pid) {
+void add_process_to_job(pid_t pgid, pid_t pid, const char* name) {
     job_t* job = find_job_by_pgid(pgid);
-    process* proc = (process*)malloc(sizeof(process));
+    if (job == NULL) return;
+
+    if (job->process_counter == job->process_capacity) {
+        int new_capacity = job->process_capacity ? job->process_capacity * 2 : 4;
+        process** grown = realloc(job->process_list, new_capacity * sizeof(process*));
+        if (grown == NULL) {
+            perror("allocation failed");
+            return;
+        }
+        job->process_list = grown;
+        job->process_capacity = new_capacity;
+    }
+
+    process* proc = (process*)calloc(1, sizeof(process));
 
     if (proc == NULL) {
         perror("allocation failed");
         return;
     }
 
-    global_process_list[global_process_counter++] = proc;
-
     proc->pid = pid;
     proc->pgid = pgid;
     proc->status = JOB_RUNNING;
-    //setpgid(pid, pgid);
+    proc->job = job;
+    proc->name = strdup(name);
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+
+    index_put(&process_index, pid, proc);
 
     job->process_list[job->process_counter++] = proc;
+    job->state_counts[JOB_RUNNING]++;
 }
 
 void remove_job(int job_id) {
-    job_t* current = job_list, *prev = NULL;
-    while (current) {
-        if (current->job_id == job_id) {
-            if (prev)
-                prev->next = current->next;
-            else
-                job_list = current->next;
-
-            for (int i = 0; i < current->process_counter; ++i)
-                free(current->process_list[i]);
-            free(current->command_line);
-            free(current);
-            return;
-        }
-        prev = current;
-        current = current->next;
+    job_t* current = find_job_by_id(job_id);
+    if (current != NULL)
+        delete_job(current);
+}
+
+void delete_job(job_t* current) {
+    if (current->prev)
+        current->prev->next = current->next;
+    else
+        job_list = current->next;
+    if (current->next)
+        current->next->prev = current->prev;
+
+    if (current->job_id > 0)
+        index_remove(&job_id_index, current->job_id);
+    if (find_job_by_pgid(current->pgid) == current)
+        index_remove(&job_pgid_index, current->pgid);
+
+    for (int i = 0; i < current->process_counter; ++i) {
+        forget_process(current->process_list[i]);
+        free(current->process_list[i]->name);
+        free(current->process_list[i]);
     }
+    free(current->process_list);
+    free(current->command_line);
+    free(current);
+}
+
+void record_process_exit(process* proc, int status, const struct rusage* usage) {
+    proc->exit_status = status;
+    clock_gettime(CLOCK_MONOTONIC, &proc->finished);
+    if (usage) {
+        proc->usage = *usage;
+        rusage_add(&proc->job->usage, usage);
+    }
+    trace_process(proc->pid, proc->name, timespec_ns(&proc->started), timespec_ns(&proc->finished));
+}
+
+// $? for a finished or stopped job: how its last process ended, with
+// 128 + the signal number for one that was killed or stopped
+int job_exit_status(job_t* job) {
+    if (job_is_stopped(job))
+        return 128 + SIGTSTP;
+    if (job->process_counter == 0)
+        return 0;
+
+    int status = job->process_list[job->process_counter - 1]->exit_status;
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+// Keeps the per-state counters in step; the job takes a state once every
+// process is in it.
+void update_process_status(process* proc, int new_status) {
+    job_t* job = proc->job;
+
+    job->state_counts[proc->status]--;
+    proc->status = new_status;
+    job->state_counts[new_status]++;
+
+    if (job->state_counts[new_status] == job->process_counter)
+        job->status = new_status;
 }
 
 void update_job_status(job_t* job, pid_t proc_pid, int check_status) {
+    process* proc = find_process(proc_pid);
 
-    for (int i = 0; i < job->process_counter; ++i) {
-        if (job->process_list[i]->pid == proc_pid)
-            job->process_list[i]->status = check_status;
+    if (proc == NULL || proc->job != job)
+        return;
 
-        if (job->process_list[i]->status != check_status)
-            return;
-    }
-    job->status = check_status;
+    update_process_status(proc, check_status);
 }
 
+// Processes that already exited stay done
 void update_all_processes_in_job(job_t* job, int new_status) {
 
     for (int i = 0; i < job->process_counter; ++i) {
-        job->process_list[i]->status = new_status;
+        if (job->process_list[i]->status != JOB_DONE)
+            job->process_list[i]->status = new_status;
     }
+    int live = job->process_counter - job->state_counts[JOB_DONE];
+    job->state_counts[JOB_RUNNING] = job->state_counts[JOB_STOPPED] = 0;
+    job->state_counts[new_status] += live;
     job->status = new_status;
 }
 
@@ -119,30 +228,34 @@ bool job_is_stopped(job_t* job) {
     
     // A job is considered stopped if ANY process is stopped
     // and no processes are still running
-    bool has_stopped = false;
-    bool has_running = false;
-    
-    for (int i = 0; i < job->process_counter; ++i) {
-        if (job->process_list[i]->status == JOB_STOPPED)
-            has_stopped = true;
-        if (job->process_list[i]->status == JOB_RUNNING)
-            has_running = true;
-    }
-    
-    return has_stopped && !has_running;
+    return job->state_counts[JOB_STOPPED] > 0 && job->state_counts[JOB_RUNNING] == 0;
 }
 
 
 void print_jobs() {
     job_t* current = job_list;
     while (current) {
+        if (current->job_id == 0) {
+            current = current->next;
+            continue;
+        }
+
         const char* status_str = (current->status == JOB_RUNNING) ? "Running" :
                                  (current->status == JOB_STOPPED) ? "Stopped" :
                                  (current->status == JOB_DONE) ? "Done" : "Unknown";
 
-        printf("[%d] PGID: %d  %s  (%s)\n",
-               current->job_id, current->pgid, status_str, current->command_line);
-        current = current->next;
+        double cpu;
+        long rss_kb;
+        double elapsed = job_usage_summary(current, &cpu, &rss_kb);
+
+        printf("[%d] PGID: %d  %s  %7.1fs  cpu %6.2fs  rss %6ldK  (%s)\n",
+               current->job_id, current->pgid, status_str, elapsed, cpu, rss_kb, current->command_line);
+
+        job_t* next = current->next;
+        // a finished job is reported once, then its slot is freed
+        if (current->status == JOB_DONE)
+            remove_job(current->job_id);
+        current = next;
     }
 }
 
@@ -151,7 +264,7 @@ job_t* get_most_recent_job(void) {
     int max_id = -1;
     
     for (job_t* job = job_list; job != NULL; job = job->next) {
-        if (job->status != JOB_DONE && job->job_id > max_id) {
+        if (job->job_id > 0 && job->status != JOB_DONE && job->job_id > max_id) {
             max_id = job->job_id;
             most_recent = job;
         }
@@ -165,7 +278,7 @@ job_t* get_most_recent_stopped_job() {
     int max_id = -1;
     
     for (job_t* job = job_list; job != NULL; job = job->next) {
-        if ((job->status == JOB_STOPPED || job_is_stopped(job)) && job->job_id > max_id) {
+        if (job->job_id > 0 && (job->status == JOB_STOPPED || job_is_stopped(job)) && job->job_id > max_id) {
             max_id = job->job_id;
             most_recent = job;
         }
@@ -175,21 +288,9 @@ job_t* get_most_recent_stopped_job() {
 }
 
 int count_processes_in_job(job_t* job) {
-    int count = 0;
-    for (int i = 0; i < job->process_counter; ++i) {
-        if (job->process_list[i]->status != JOB_DONE) {
-            count++;
-        }
-    }
-    return count;
+    return job->process_counter - job->state_counts[JOB_DONE];
 }
 
 int all_processes_done(job_t* job) {
-    
-    for (int i = 0; i < job->process_counter; ++i) {
-        if (job->process_list[i]->status != JOB_DONE) {
-            return 0; 
-        }
-    }
-    return 1; 
-}
\ No newline at end of file
+    return job->state_counts[JOB_DONE] == job->process_counter;
+}
@@ -3,29 +3,150 @@
 #include "../headers/input.h"
 #include "../headers/parser.h"
 #include "../headers/variables.h"
+#include "../headers/execute.h"
+#include "../headers/events.h"
+#include "../headers/trace.h"
+#include "../headers/bytecode.h"
+#include "../headers/parsecache.h"
 
-extern command command_default = {0, NULL, NULL, NULL, 0, 0};
-extern pipeline pipeline_default = {0, NULL, 0};
+// Everything parsed from one line; reset once the line has run
+static arena line_arena;
 
-int main(void) {
-    shell_tty = STDIN_FILENO;
-    shell_interactive = isatty(shell_tty);
+// A script on its first run: every parsed unit is recorded, and the
+// compiled form is cached once the last one is in
+static bytecode_writer* compiler = NULL;
+static const char* script_path = NULL;
+static struct stat script_stat;
 
-    if (shell_interactive) {
-        shell_pgid = getpgrp();
-        if (getpid() != shell_pgid) {
-            if (setpgid(0, 0) < 0) {
-                perror("setpgid");
-                exit(1);
-            }
-            shell_pgid = getpgrp();
+static void finish_compiling(void) {
+    bytecode_save(compiler, script_path, &script_stat);
+    bytecode_writer_free(compiler);
+    compiler = NULL;
+}
+
+// The lines of a command that is still open (an if without its fi, a
+// trailing |), joined with newlines
+static char* pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_cap = 0;
+
+static char* pending_append(const char* line) {
+    size_t len = strlen(line);
+    if (pending_len + len + 2 > pending_cap) {
+        size_t new_cap = pending_cap ? pending_cap : INPUT_BUF;
+        while (new_cap < pending_len + len + 2) new_cap *= 2;
+        char* grown = realloc(pending, new_cap);
+        if (grown == NULL) {
+            perror("realloc");
+            exit(1);
         }
-        tcsetpgrp(shell_tty, shell_pgid);
+        pending = grown;
+        pending_cap = new_cap;
     }
+    if (pending_len > 0) pending[pending_len++] = '\n';
+    memcpy(pending + pending_len, line, len + 1);
+    pending_len += len;
+    return pending;
+}
 
-    load_environment();
-    install_all_shell_handlers();
+// Runs one parsed line and lets it go. Returns 1 when the shell should exit.
+static int run_tree(node* tree, int is_tail, const char* input, uint64_t line_start) {
+    if (is_tail)
+        mark_tail(tree);
+
+    execute_node(&line_arena, tree);
+
+    check_child_status();
+    trace_record(TRACE_LINE, line_start, input);
+    arena_reset(&line_arena);
+    return exit_requested;
+}
+
+// Returns 1 when the shell should exit, -1 when the input stops in the
+// middle of a command and the next line has to be added to it
+static int run_line(char* input, int is_tail) {
+    // Skip empty lines
+    if (input[0] == '\0') return 0;
+
+    trace_sync_output();
+    uint64_t line_start = trace_now();
+    interrupted = 0;
+
+    // the tail gets marked to exec in place, so it can't share a cached tree
+    node* tree = is_tail ? parse_input(&line_arena, input) : parsecache_parse(input);
+    trace_record(TRACE_PARSE, line_start, NULL);
+    if (tree == NULL) {
+        arena_reset(&line_arena);
+        if (parse_incomplete) return -1;
+        // a script with syntax errors is never cached
+        if (compiler) compiler->failed = 1;
+        last_status = 2;
+        return 0;
+    }
+
+    if (compiler) {
+        bytecode_add(compiler, tree, input);
+        // before it runs: the last line may exec in place of the shell
+        if (is_tail) finish_compiling();
+    }
+
+    return run_tree(tree, is_tail, input, line_start);
+}
+
+// A script compiled on an earlier run: units come out of the cache ready
+// to run, with nothing to read or parse
+static void run_compiled(bytecode_program* prog) {
+    while (!bytecode_at_end(prog)) {
+        check_child_status();
+        trace_sync_output();
+        uint64_t line_start = trace_now();
+        interrupted = 0;
+
+        const char* text;
+        node* tree = bytecode_next(prog, &line_arena, &text);
+        trace_record(TRACE_PARSE, line_start, NULL);
+        if (tree == NULL) {
+            fprintf(stderr, "shell: %s: compiled script is damaged\n", script_path);
+            last_status = 2;
+            break;
+        }
+
+        if (run_tree(tree, bytecode_at_end(prog), text, line_start))
+            break;
+    }
+    bytecode_close(prog);
+}
+
+// Scripts, -c strings and piped input: no prompt, no termios, no history
+static void run_batch(line_reader* reader) {
+    char* line;
+    while ((line = reader_next_line(reader)) != NULL) {
+        check_child_status();
+        int continued = pending_len > 0;
+        if (continued) line = pending_append(line);
+
+        reader_sync(reader);
+        int r = run_line(line, reader_at_end(reader));
+        if (r < 0) {
+            if (!continued) pending_append(line);
+            continue;
+        }
+        pending_len = 0;
+        if (r > 0) break;
+    }
+
+    if (pending_len > 0) {
+        report_incomplete();
+        last_status = 2;
+    } else if (compiler && line == NULL) {
+        finish_compiling();
+    }
+    reader_close(reader);
+}
+
+static void run_interactive(void) {
     enable_raw_mode();
+    history_init();
 
     char input[INPUT_BUF];
 
@@ -40,25 +161,83 @@ int main(void) {
             input[len - 1] = '\0';
 
         // Skip empty lines
-        if (input[0] == '\0') continue;
+        if (input[0] == '\0' && pending_len == 0) continue;
 
         add_history(input);
 
-        if (strcmp(input, "exit") == 0)
-            break;
+        int continued = pending_len > 0;
+        int r = run_line(continued ? pending_append(input) : input, 0);
+        if (r < 0) {
+            if (!continued) pending_append(input);
+            prompt_set_continuation(1);
+            continue;
+        }
+        pending_len = 0;
+        prompt_set_continuation(0);
+        if (r > 0) break;
+    }
+}
 
-        pipeline* curr_pipeline = parse_input(input, MAX_CMDS);
-        if (curr_pipeline == NULL) continue;
+int main(int argc, char** argv) {
+    line_reader reader;
+    int batch = 0;
+    bytecode_program program;
+    bytecode_writer writer;
+    int compiled = 0;
 
-        if (curr_pipeline->cmdc == 1) {
-            execute_single_command(curr_pipeline);
-        } else {
-            execute_pipeline(curr_pipeline);
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        reader_open_string(&reader, argv[2]);
+        batch = 1;
+    } else if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        fprintf(stderr, "shell: -c: option requires an argument\n");
+        return 2;
+    } else if (argc > 1) {
+        // only regular files: the cache is keyed by their mtime and size
+        if (stat(argv[1], &script_stat) == 0 && S_ISREG(script_stat.st_mode)) {
+            script_path = argv[1];
+            compiled = bytecode_open(&program, script_path, &script_stat) == 0;
         }
+        if (!compiled && reader_open_file(&reader, argv[1]) < 0)
+            return 127;
+        batch = 1;
+    } else if (!isatty(STDIN_FILENO)) {
+        reader_open_stdin(&reader, STDIN_FILENO);
+        batch = 1;
+    }
 
-        check_child_status();
-        free_pipeline_mem(curr_pipeline);
+    shell_tty = STDIN_FILENO;
+    shell_interactive = !batch && isatty(shell_tty);
+
+    if (shell_interactive) {
+        shell_pgid = getpgrp();
+        if (getpid() != shell_pgid) {
+            if (setpgid(0, 0) < 0) {
+                perror("setpgid");
+                exit(1);
+            }
+            shell_pgid = getpgrp();
+        }
+        tcsetpgrp(shell_tty, shell_pgid);
     }
 
-    return 0;
-}
+    load_environment();
+    install_all_shell_handlers();
+    if (events_init(shell_interactive) < 0)
+        return 1;
+
+    if (compiled) {
+        run_compiled(&program);
+    } else if (batch) {
+        if (script_path) {
+            bytecode_writer_init(&writer);
+            compiler = &writer;
+        }
+        run_batch(&reader);
+        // a script that exited early is compiled on a run that doesn't
+        if (compiler) bytecode_writer_free(compiler);
+    } else {
+        run_interactive();
+    }
+
+    return last_status;
+}
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include "../headers/spawn.h"
+
+#include "../headers/execute.h"
+#include "../headers/parser.h"
+#include "../headers/pathcache.h"
+#include "../headers/variables.h"
+#include "../headers/input.h"
+#include "../headers/trace.h"
+
+// Signals the shell catches or ignores; children get them back at SIG_DFL,
+// same as setup_child_signals_and_pgrp does for forked children.
+static const int child_default_signals[] = { SIGINT, SIGTSTP, SIGTTOU, SIGTTIN, SIGCHLD, SIGPIPE };
+
+static int build_file_actions(posix_spawn_file_actions_t* fa, command* cmd, const spawn_attrs* attrs) {
+    int err = 0;
+
+    if (attrs->in_fd >= 0)
+        err = err ? err : posix_spawn_file_actions_adddup2(fa, attrs->in_fd, STDIN_FILENO);
+    if (attrs->out_fd >= 0)
+        err = err ? err : posix_spawn_file_actions_adddup2(fa, attrs->out_fd, STDOUT_FILENO);
+
+    // Redirections are applied after the pipe ends, like duplicate_fd
+    if (cmd->redirectInput != NULL)
+        err = err ? err : posix_spawn_file_actions_addopen(fa, STDIN_FILENO,
+                                                           cmd->redirectInput, O_RDONLY, 0);
+
+    if (cmd->redirectOutput != NULL) {
+        int flags = O_WRONLY | O_CREAT | (cmd->appendOutput ? O_APPEND : O_TRUNC);
+        err = err ? err : posix_spawn_file_actions_addopen(fa, STDOUT_FILENO,
+                                                           cmd->redirectOutput, flags, 0644);
+    }
+
+    return err;
+}
+
+static int build_attr(posix_spawnattr_t* attr, const spawn_attrs* attrs) {
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); ++i)
+        sigaddset(&defaults, child_default_signals[i]);
+
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+    if (attrs->sigmask)
+        flags |= POSIX_SPAWN_SETSIGMASK;
+
+    int err = posix_spawnattr_setflags(attr, flags);
+    if (!err) err = posix_spawnattr_setpgroup(attr, attrs->pgid);
+    if (!err) err = posix_spawnattr_setsigdefault(attr, &defaults);
+    if (!err && attrs->sigmask) err = posix_spawnattr_setsigmask(attr, attrs->sigmask);
+    return err;
+}
+
+// Runs a file without a #! line through /bin/sh, as execvp would
+static int spawn_as_script(pid_t* pid, const char* path, command* cmd,
+                           posix_spawn_file_actions_t* fa, posix_spawnattr_t* attr) {
+    char* argv[cmd->argc + 2];
+    argv[0] = "/bin/sh";
+    argv[1] = (char*)path;
+    for (size_t i = 1; i <= cmd->argc; ++i)
+        argv[i + 1] = cmd->argv[i];
+
+    return posix_spawn(pid, argv[0], fa, attr, argv, var_environ());
+}
+
+static const char* timed_lookup(const char* name) {
+    uint64_t start = trace_now();
+    const char* path = pathcache_lookup(name);
+    trace_record(TRACE_PATH_LOOKUP, start, name);
+    return path;
+}
+
+static int spawn_resolved(pid_t* pid, command* cmd,
+                          posix_spawn_file_actions_t* fa, posix_spawnattr_t* attr) {
+    const char* path = timed_lookup(cmd->argv[0]);
+    if (path == NULL)
+        return ENOENT;
+
+    int err = posix_spawn(pid, path, fa, attr, cmd->argv, var_environ());
+
+    // The binary moved or vanished since it was hashed: look it up again
+    if ((err == ENOENT || err == EACCES) && path != cmd->argv[0]) {
+        pathcache_forget(cmd->argv[0]);
+        path = pathcache_lookup(cmd->argv[0]);
+        if (path == NULL)
+            return ENOENT;
+        err = posix_spawn(pid, path, fa, attr, cmd->argv, var_environ());
+    }
+
+    if (err == ENOEXEC)
+        err = spawn_as_script(pid, path, cmd, fa, attr);
+
+    return err;
+}
+
+// glibc implements posix_spawn with clone(CLONE_VM | CLONE_VFORK), so the
+// shell's page tables (and ASan shadow) are never copied.
+pid_t spawn_external(command* cmd, const spawn_attrs* attrs) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    pid_t pid = -1;
+
+    if (posix_spawn_file_actions_init(&fa) != 0) {
+        perror("posix_spawn_file_actions_init");
+        return -1;
+    }
+    if (posix_spawnattr_init(&attr) != 0) {
+        perror("posix_spawnattr_init");
+        posix_spawn_file_actions_destroy(&fa);
+        return -1;
+    }
+
+    int err = build_file_actions(&fa, cmd, attrs);
+    if (!err) err = build_attr(&attr, attrs);
+    if (!err) err = spawn_resolved(&pid, cmd, &fa, &attr);
+
+    if (err) {
+        fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(err));
+        pid = -1;
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    return pid;
+}
+
+// Builtins that have to live in their own process still need a real fork
+pid_t spawn_builtin(command* cmd, internal_func func, const spawn_attrs* attrs) {
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0) { // CHILD
+        if (attrs->sigmask)
+            sigprocmask(SIG_SETMASK, attrs->sigmask, NULL);
+
+        setup_child_signals_and_pgrp(attrs->pgid, 0);
+
+        if (attrs->in_fd >= 0) dup2(attrs->in_fd, STDIN_FILENO);
+        if (attrs->out_fd >= 0) dup2(attrs->out_fd, STDOUT_FILENO);
+
+        // no exec follows, so O_CLOEXEC won't drop the other pipe ends
+        for (size_t i = 0; i < attrs->close_count; ++i)
+            close(attrs->close_fds[i]);
+
+        duplicate_fd(cmd);
+
+        int status = func(cmd);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    return pid;
+}
+
+// The shell's own stdin/stdout/stderr, kept aside while exec_command's
+// redirections are in place so a failed exec can put them back
+static void save_std_fds(int saved[3]) {
+    for (int fd = 0; fd < 3; ++fd)
+        saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+}
+
+static void restore_std_fds(int saved[3]) {
+    for (int fd = 0; fd < 3; ++fd) {
+        if (saved[fd] < 0) continue;
+        dup2(saved[fd], fd);
+        close(saved[fd]);
+    }
+}
+
+// Turns the shell itself into cmd: redirections land on the shell's own
+// fds and caught signals go back to SIG_DFL before execve. Only returns,
+// with -1 and the shell's fds and handlers restored, if the command can't
+// be run.
+int exec_command(command* cmd) {
+    const char* path = timed_lookup(cmd->argv[0]);
+    if (path == NULL) {
+        fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(ENOENT));
+        return -1;
+    }
+
+    int saved[3];
+    save_std_fds(saved);
+
+    if (redirect_fds(cmd) < 0) {
+        restore_std_fds(saved);
+        return -1;
+    }
+
+    fflush(stdout);
+    if (shell_interactive)
+        disable_raw_mode();
+
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); ++i)
+        signal(child_default_signals[i], SIG_DFL);
+
+    sigset_t empty, oldmask;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, &oldmask);
+
+    execve(path, cmd->argv, var_environ());
+
+    // The binary moved or vanished since it was hashed: look it up again
+    if ((errno == ENOENT || errno == EACCES) && path != cmd->argv[0]) {
+        int err = errno;
+        pathcache_forget(cmd->argv[0]);
+        path = pathcache_lookup(cmd->argv[0]);
+        if (path != NULL)
+            execve(path, cmd->argv, var_environ());
+        else
+            errno = err;
+    }
+
+    if (path != NULL && errno == ENOEXEC) {
+        char* argv[cmd->argc + 2];
+        argv[0] = "/bin/sh";
+        argv[1] = (char*)path;
+        for (size_t i = 1; i <= cmd->argc; ++i)
+            argv[i + 1] = cmd->argv[i];
+        execve(argv[0], argv, var_environ());
+    }
+
+    int err = errno;
+
+    // Still the shell after all
+    restore_std_fds(saved);
+    fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(err));
+
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    install_all_shell_handlers();
+    if (shell_interactive)
+        enable_raw_mode();
+    return -1;
+}
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "../headers/subst.h"
+
+#include "../headers/parser.h"
+#include "../headers/execute.h"
+#include "../headers/internalfuncs.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Whether running the tree could change the shell itself: a builtin such
+// as cd or exit, or a command whose name is only known once expanded
+static int touches_shell(const node* n) {
+    if (n == NULL)
+        return 0;
+    // a for loop sets its variable
+    if (n->type == NODE_FOR)
+        return 1;
+    if (n->type == NODE_CASE) {
+        for (size_t i = 0; i < n->itemc; ++i)
+            if (touches_shell(n->items[i].body)) return 1;
+        return 0;
+    }
+    if (n->type != NODE_PIPELINE)
+        return touches_shell(n->left) || touches_shell(n->right) || touches_shell(n->alternative);
+
+    const pipeline* p = n->pipeline;
+    for (size_t i = 0; i < p->cmdc; ++i) {
+        const command* cmd = p->cmds[i];
+        if (cmd->body) {
+            if (!cmd->subshell && touches_shell(cmd->body)) return 1;
+            continue;
+        }
+        if (cmd->wordc == 0) continue;
+        if (cmd->builtin == BUILTIN_UNRESOLVED) return 1;
+        const internal_pair* builtin = command_builtin(cmd);
+        if (builtin && builtin->run_in_parent) return 1;
+    }
+    return 0;
+}
+
+// The line runs through the normal executor with stdout pointed at a
+// memfd, so builtins that can run in the shell do, and external commands
+// are spawned without forking the shell first. A file rather than a pipe:
+// the shell waits for the job before reading, and the size is known up
+// front, so the output lands in the arena with a single read.
+char* command_substitution(arena* a, const char* text) {
+    node* tree = parse_input(a, (char*)text);
+    if (tree == NULL) return NULL;
+    if (tree->type == NODE_PIPELINE && tree->pipeline->cmdc == 0)
+        return arena_strdup(a, "");
+
+    int fd = memfd_create("substitution", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create");
+        return NULL;
+    }
+
+    fflush(stdout);
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDOUT_FILENO);
+
+    // cd, exit and the like must not touch the shell from in here: such
+    // a line runs in a process of its own
+    int saved_status = last_status;
+    if (touches_shell(tree))
+        execute_subshell(a, tree);
+    else
+        execute_node(a, tree);
+    last_status = saved_status;
+
+    fflush(stdout);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_out);
+
+    struct stat st;
+    size_t size = (fstat(fd, &st) == 0) ? st.st_size : 0;
+    char* out = arena_alloc(a, size + 1);
+    if (out == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, out + got, size - got, got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+
+    while (got > 0 && out[got - 1] == '\n') --got;
+    out[got] = '\0';
+    return out;
+}
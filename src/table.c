@@ -0,0 +1,96 @@
+#include "../headers/table.h"
+
+#define TABLE_MIN_CAPACITY 64
+
+// 0 marks a free slot, so a hash that happens to be 0 is stored as 1
+static uint64_t stored_hash(uint64_t hash) {
+    return hash ? hash : 1;
+}
+
+static uint64_t* entry_at(const hash_table* t, size_t i) {
+    return (uint64_t*)(t->slots + i * t->entry_size);
+}
+
+// Fibonacci hashing: pids and trigrams are far from random in their low bits
+static size_t home_slot(const hash_table* t, uint64_t hash) {
+    return (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> t->shift);
+}
+
+static size_t free_slot(const hash_table* t, uint64_t hash) {
+    size_t mask = t->capacity - 1;
+    size_t i = home_slot(t, hash);
+    while (*entry_at(t, i) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int grow(hash_table* t) {
+    hash_table bigger = *t;
+    bigger.capacity = t->capacity ? t->capacity * 2 : TABLE_MIN_CAPACITY;
+    bigger.shift = 64 - __builtin_ctzll(bigger.capacity);
+    bigger.slots = calloc(bigger.capacity, t->entry_size);
+    if (bigger.slots == NULL) {
+        perror("allocation failed");
+        return -1;
+    }
+
+    for (size_t i = 0; i < t->capacity; ++i) {
+        uint64_t* e = entry_at(t, i);
+        if (*e != 0)
+            memcpy(entry_at(&bigger, free_slot(&bigger, *e)), e, t->entry_size);
+    }
+    free(t->slots);
+    *t = bigger;
+    return 0;
+}
+
+void* table_find(const hash_table* t, uint64_t hash, table_equal equal, const void* key) {
+    if (t->capacity == 0) return NULL;
+
+    hash = stored_hash(hash);
+    size_t mask = t->capacity - 1;
+    for (size_t i = home_slot(t, hash); ; i = (i + 1) & mask) {
+        uint64_t* e = entry_at(t, i);
+        if (*e == 0) return NULL;
+        if (*e == hash && (equal == NULL || equal(e, key))) return e;
+    }
+}
+
+void* table_insert(hash_table* t, uint64_t hash, table_equal equal, const void* key) {
+    void* found = table_find(t, hash, equal, key);
+    if (found) return found;
+
+    // keep the load factor under 1/2 so probe runs stay short
+    if ((t->count + 1) * 2 > t->capacity && grow(t) < 0)
+        return NULL;
+
+    hash = stored_hash(hash);
+    uint64_t* e = entry_at(t, free_slot(t, hash));
+    memset(e, 0, t->entry_size);
+    *e = hash;
+    ++t->count;
+    return e;
+}
+
+void table_remove(hash_table* t, void* entry) {
+    size_t mask = t->capacity - 1;
+    size_t hole = ((char*)entry - t->slots) / t->entry_size;
+
+    for (size_t j = (hole + 1) & mask; *entry_at(t, j) != 0; j = (j + 1) & mask) {
+        size_t home = home_slot(t, *entry_at(t, j));
+        // move j into the hole unless its home lies cyclically in (hole, j]
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            memcpy(entry_at(t, hole), entry_at(t, j), t->entry_size);
+            hole = j;
+        }
+    }
+    *entry_at(t, hole) = 0;
+    --t->count;
+}
+
+void* table_next(const hash_table* t, void* prev) {
+    size_t i = prev ? ((char*)prev - t->slots) / t->entry_size + 1 : 0;
+    for (; i < t->capacity; ++i)
+        if (*entry_at(t, i) != 0) return entry_at(t, i);
+    return NULL;
+}
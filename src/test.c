@@ -0,0 +1,187 @@
+#include "../headers/internalfuncs.h"
+
+#include <sys/stat.h>
+
+// test expr / [ expr ]
+//
+// Runs in the shell: loop and if conditions cost no process. Supports
+// ! ( ) -a -o, the string tests -n -z = == != < >, the integer tests
+// -eq -ne -lt -le -gt -ge and the file tests -e -f -d -r -w -x -s -L -h.
+// Exit status 0 for true, 1 for false and 2 for a malformed expression.
+
+typedef struct {
+    char** argv;
+    size_t argc;
+    size_t pos;
+    const char* error;
+} test_state;
+
+static int test_or(test_state* t);
+
+static const char* peek(test_state* t, size_t ahead) {
+    return (t->pos + ahead < t->argc) ? t->argv[t->pos + ahead] : NULL;
+}
+
+static int test_fail(test_state* t, const char* error) {
+    if (t->error == NULL) t->error = error;
+    return 0;
+}
+
+static int parse_integer(test_state* t, const char* s, long long* out) {
+    char* end;
+    errno = 0;
+    *out = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        test_fail(t, "integer expression expected");
+        return -1;
+    }
+    return 0;
+}
+
+static int is_binary_op(const char* op) {
+    static const char* const ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                       "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+    for (int i = 0; ops[i]; ++i)
+        if (strcmp(op, ops[i]) == 0) return 1;
+    return 0;
+}
+
+static int binary_test(test_state* t, const char* left, const char* op, const char* right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(left, right) > 0;
+
+    struct stat a, b;
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        int have_a = stat(left, &a) == 0, have_b = stat(right, &b) == 0;
+        if (op[1] == 'e')
+            return have_a && have_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+        if (!have_a || !have_b)
+            return (op[1] == 'n') ? have_a : have_b;
+        long long ta = a.st_mtim.tv_sec * 1000000000LL + a.st_mtim.tv_nsec;
+        long long tb = b.st_mtim.tv_sec * 1000000000LL + b.st_mtim.tv_nsec;
+        return (op[1] == 'n') ? ta > tb : ta < tb;
+    }
+
+    long long x, y;
+    if (parse_integer(t, left, &x) < 0 || parse_integer(t, right, &y) < 0) return 0;
+    switch (op[1] * 256 + op[2]) {
+        case 'e' * 256 + 'q': return x == y;
+        case 'n' * 256 + 'e': return x != y;
+        case 'l' * 256 + 't': return x < y;
+        case 'l' * 256 + 'e': return x <= y;
+        case 'g' * 256 + 't': return x > y;
+        default:              return x >= y;
+    }
+}
+
+static int is_unary_op(const char* op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("nzefdrwxsLhbcpS", op[1]) != NULL;
+}
+
+static int unary_test(char op, const char* arg) {
+    if (op == 'n') return arg[0] != '\0';
+    if (op == 'z') return arg[0] == '\0';
+
+    struct stat st;
+    if (op == 'L' || op == 'h')
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    if (op == 'r') return access(arg, R_OK) == 0;
+    if (op == 'w') return access(arg, W_OK) == 0;
+    if (op == 'x') return access(arg, X_OK) == 0;
+
+    if (stat(arg, &st) < 0) return 0;
+    switch (op) {
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        default:  return 1;   // -e
+    }
+}
+
+static int test_primary(test_state* t) {
+    const char* arg = peek(t, 0);
+    if (arg == NULL) return test_fail(t, "argument expected");
+
+    // a binary operator wins over treating the first word as an operator,
+    // so [ -n = -n ] compares two strings
+    const char* op = peek(t, 1);
+    if (op && peek(t, 2) && is_binary_op(op)) {
+        t->pos += 3;
+        return binary_test(t, arg, op, t->argv[t->pos - 1]);
+    }
+
+    if (strcmp(arg, "!") == 0 && op) {
+        t->pos++;
+        return !test_primary(t);
+    }
+
+    if (strcmp(arg, "(") == 0 && op) {
+        t->pos++;
+        int r = test_or(t);
+        const char* close = peek(t, 0);
+        if (close == NULL || strcmp(close, ")") != 0) return test_fail(t, "`)' expected");
+        t->pos++;
+        return r;
+    }
+
+    if (is_unary_op(arg) && op) {
+        t->pos += 2;
+        return unary_test(arg[1], op);
+    }
+
+    // a lone word is true when it isn't empty
+    t->pos++;
+    return arg[0] != '\0';
+}
+
+static int test_and(test_state* t) {
+    int r = test_primary(t);
+    while (peek(t, 0) && strcmp(peek(t, 0), "-a") == 0) {
+        t->pos++;
+        int right = test_primary(t);
+        r = r && right;
+    }
+    return r;
+}
+
+static int test_or(test_state* t) {
+    int r = test_and(t);
+    while (peek(t, 0) && strcmp(peek(t, 0), "-o") == 0) {
+        t->pos++;
+        int right = test_and(t);
+        r = r || right;
+    }
+    return r;
+}
+
+int internal_test(const command* cmd) {
+    test_state t = { cmd->argv + 1, cmd->argc - 1, 0, NULL };
+    const char* name = cmd->argv[0];
+
+    if (strcmp(name, "[") == 0) {
+        if (t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        t.argc--;
+    }
+
+    // no expression is false
+    if (t.argc == 0) return 1;
+
+    int r = test_or(&t);
+    if (t.error == NULL && t.pos < t.argc)
+        t.error = "too many arguments";
+    if (t.error) {
+        fprintf(stderr, "%s: %s\n", name, t.error);
+        return 2;
+    }
+    return r ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include "../headers/trace.h"
+#include "../headers/variables.h"
+#include "../headers/usage.h"
+
+// Log-linear histogram: values below 2^SUB_BITS get a bucket each; above
+// that, every power of two is split into 2^SUB_BITS linear sub-buckets,
+// so any recorded value is off by at most 1/16 (about 6%).
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define HIST_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} histogram;
+
+static histogram stats[TRACE_PHASES];
+
+static const char* phase_names[TRACE_PHASES] = {
+    "line", "parse", "path_lookup", "pipe_setup", "spawn", "terminal", "wait", "builtin"
+};
+
+static FILE* trace_out = NULL;
+static char* trace_path = NULL;
+
+static size_t bucket_of(uint64_t v) {
+    if (v < SUB_COUNT) return v;
+    int exp = 63 - __builtin_clzll(v);
+    size_t sub = (v >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+    return (size_t)(exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// Smallest value that lands in bucket b
+static uint64_t bucket_floor(size_t b) {
+    if (b < SUB_COUNT) return b;
+    int exp = b / SUB_COUNT + SUB_BITS - 1;
+    uint64_t sub = b % SUB_COUNT;
+    return (1ull << exp) | (sub << (exp - SUB_BITS));
+}
+
+static void hist_add(histogram* h, uint64_t v) {
+    h->counts[bucket_of(v)]++;
+    if (h->total == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->total++;
+    h->sum += v;
+}
+
+static uint64_t hist_percentile(const histogram* h, double pct) {
+    uint64_t rank = (uint64_t)(pct / 100.0 * h->total + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            uint64_t v = bucket_floor(b);
+            return v < h->min ? h->min : (v > h->max ? h->max : v);
+        }
+    }
+    return h->max;
+}
+
+// Chrome trace-event "complete" event; the array is left open, which the
+// trace viewers accept, so a crash never leaves an unreadable file.
+static void write_event(const char* name, pid_t tid, uint64_t start_ns, uint64_t end_ns, const char* detail) {
+    fprintf(trace_out, "{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"pid\":%ld,\"tid\":%ld",
+            name, start_ns / 1e3, (end_ns - start_ns) / 1e3, (long)getpid(), (long)tid);
+    if (detail) {
+        fputs(",\"args\":{\"detail\":", trace_out);
+        json_write_string(trace_out, detail);
+        fputc('}', trace_out);
+    }
+    fputs("},\n", trace_out);
+}
+
+void trace_record(trace_phase phase, uint64_t start_ns, const char* detail) {
+    uint64_t end_ns = trace_now();
+    hist_add(&stats[phase], end_ns - start_ns);
+
+    if (trace_out)
+        write_event(phase_names[phase], getpid(), start_ns, end_ns, detail);
+}
+
+void trace_process(pid_t pid, const char* name, uint64_t start_ns, uint64_t end_ns) {
+    if (trace_out)
+        write_event(name, pid, start_ns, end_ns, NULL);
+}
+
+void trace_sync_output(void) {
+    const char* path = get_var("SHELL_TRACE");
+    if (path && *path == '\0') path = NULL;
+
+    if (path == NULL && trace_path == NULL) return;
+    if (path && trace_path && strcmp(path, trace_path) == 0) {
+        fflush(trace_out);
+        return;
+    }
+
+    if (trace_out) fclose(trace_out);
+    free(trace_path);
+    trace_out = NULL;
+    trace_path = NULL;
+    if (path == NULL) return;
+
+    trace_out = fopen(path, "w");
+    if (trace_out == NULL) {
+        perror(path);
+        return;
+    }
+    fcntl(fileno(trace_out), F_SETFD, FD_CLOEXEC);
+    trace_path = strdup(path);
+    fputs("[\n", trace_out);
+}
+
+void trace_print_stats(void) {
+    printf("%-12s %8s %10s %10s %10s %10s %10s %10s\n",
+           "phase", "count", "min_us", "p50_us", "p90_us", "p99_us", "max_us", "mean_us");
+
+    for (int i = 0; i < TRACE_PHASES; ++i) {
+        const histogram* h = &stats[i];
+        if (h->total == 0) continue;
+
+        printf("%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               phase_names[i], (unsigned long long)h->total, h->min / 1e3,
+               hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+               hist_percentile(h, 99) / 1e3, h->max / 1e3, (double)h->sum / h->total / 1e3);
+    }
+}
+
+void trace_reset_stats(void) {
+    memset(stats, 0, sizeof(stats));
+}
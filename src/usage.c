@@ -0,0 +1,197 @@
+#include "../headers/usage.h"
+#include "../headers/variables.h"
+
+static double timeval_seconds(const struct timeval* tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void timeval_add(struct timeval* total, const struct timeval* tv) {
+    total->tv_sec += tv->tv_sec;
+    total->tv_usec += tv->tv_usec;
+    if (total->tv_usec >= 1000000) {
+        total->tv_sec++;
+        total->tv_usec -= 1000000;
+    }
+}
+
+static void timeval_sub(struct timeval* total, const struct timeval* tv) {
+    total->tv_sec -= tv->tv_sec;
+    total->tv_usec -= tv->tv_usec;
+    if (total->tv_usec < 0) {
+        total->tv_sec--;
+        total->tv_usec += 1000000;
+    }
+}
+
+void usage_mark_now(usage_mark* mark) {
+    clock_gettime(CLOCK_MONOTONIC, &mark->started);
+    getrusage(RUSAGE_SELF, &mark->self);
+}
+
+void rusage_add(struct rusage* total, const struct rusage* ru) {
+    timeval_add(&total->ru_utime, &ru->ru_utime);
+    timeval_add(&total->ru_stime, &ru->ru_stime);
+    if (ru->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = ru->ru_maxrss;
+    total->ru_minflt += ru->ru_minflt;
+    total->ru_majflt += ru->ru_majflt;
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+double timespec_seconds_between(const struct timespec* from, const struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void print_duration(const char* label, double seconds) {
+    int minutes = (int)(seconds / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+static void print_stage(const char* name, long pid, int status, double real, const struct rusage* ru) {
+    fprintf(stderr, "%-12s %7ld %6d %8.3f %8.3f %8.3f %9ld %7ld %7ld %8ld %6ld\n",
+            name, pid, status, real, timeval_seconds(&ru->ru_utime), timeval_seconds(&ru->ru_stime),
+            ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+}
+
+// exit code, or 128+signal like $? in other shells
+static int exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+void usage_print_report(const usage_mark* mark, const job_t* job) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct rusage shell;
+    getrusage(RUSAGE_SELF, &shell);
+    timeval_sub(&shell.ru_utime, &mark->self.ru_utime);
+    timeval_sub(&shell.ru_stime, &mark->self.ru_stime);
+    shell.ru_minflt -= mark->self.ru_minflt;
+    shell.ru_majflt -= mark->self.ru_majflt;
+    shell.ru_nvcsw -= mark->self.ru_nvcsw;
+    shell.ru_nivcsw -= mark->self.ru_nivcsw;
+
+    struct rusage total = shell;
+    total.ru_maxrss = 0;
+    if (job) rusage_add(&total, &job->usage);
+
+    double real = timespec_seconds_between(&mark->started, &now);
+
+    fputc('\n', stderr);
+    print_duration("real", real);
+    print_duration("user", timeval_seconds(&total.ru_utime));
+    print_duration("sys", timeval_seconds(&total.ru_stime));
+
+    if (job == NULL || job->process_counter == 0) return;
+
+    fprintf(stderr, "%-12s %7s %6s %8s %8s %8s %9s %7s %7s %8s %6s\n",
+            "stage", "pid", "status", "real", "user", "sys", "maxrss_kb", "vcsw", "ivcsw", "minflt", "majflt");
+    for (int i = 0; i < job->process_counter; ++i) {
+        const process* proc = job->process_list[i];
+        double stage_real = timespec_seconds_between(&proc->started,
+                                                     proc->status == JOB_DONE ? &proc->finished : &now);
+        print_stage(proc->name, proc->pid, exit_code(proc->exit_status), stage_real, &proc->usage);
+    }
+    // the shell's share: spawning, waiting and any builtin stage it ran itself
+    print_stage("(shell)", getpid(), 0, real, &shell);
+}
+
+// utime, stime and rss of a running process from /proc/<pid>/stat
+static int read_live_usage(pid_t pid, double* cpu_seconds, long* rss_kb) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    // the command name may contain spaces; fields resume after its ')'
+    char* p = strrchr(buf, ')');
+    if (p == NULL) return -1;
+
+    unsigned long utime, stime;
+    long rss;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &utime, &stime, &rss) != 3)
+        return -1;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    *cpu_seconds = (double)(utime + stime) / ticks;
+    *rss_kb = rss * (sysconf(_SC_PAGESIZE) / 1024);
+    return 0;
+}
+
+double job_usage_summary(const job_t* job, double* cpu_seconds, long* rss_kb) {
+    *cpu_seconds = timeval_seconds(&job->usage.ru_utime) + timeval_seconds(&job->usage.ru_stime);
+    *rss_kb = job->usage.ru_maxrss;
+
+    for (int i = 0; i < job->process_counter; ++i) {
+        const process* proc = job->process_list[i];
+        if (proc->status == JOB_DONE) continue;
+
+        double cpu;
+        long rss;
+        if (read_live_usage(proc->pid, &cpu, &rss) == 0) {
+            *cpu_seconds += cpu;
+            if (rss > *rss_kb) *rss_kb = rss;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_seconds_between(&job->started, &now);
+}
+
+void json_write_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)s; *p; ++p) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json_usage(FILE* out, const struct rusage* ru) {
+    fprintf(out, "\"user_s\":%.6f,\"sys_s\":%.6f,\"maxrss_kb\":%ld,\"vcsw\":%ld,\"ivcsw\":%ld,"
+                 "\"minflt\":%ld,\"majflt\":%ld",
+            timeval_seconds(&ru->ru_utime), timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+}
+
+void usage_log_job(const job_t* job) {
+    const char* path = get_var("SHELL_USAGE_LOG");
+    if (path == NULL || *path == '\0') return;
+
+    FILE* out = fopen(path, "a");
+    if (out == NULL) return;
+
+    struct timespec now, wall;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    fprintf(out, "{\"time\":%ld.%03ld,\"pgid\":%ld,\"job\":", (long)wall.tv_sec, wall.tv_nsec / 1000000,
+            (long)job->pgid);
+    json_write_string(out, job->command_line);
+    fprintf(out, ",\"real_s\":%.6f,", timespec_seconds_between(&job->started, &now));
+    write_json_usage(out, &job->usage);
+    fputs(",\"stages\":[", out);
+
+    for (int i = 0; i < job->process_counter; ++i) {
+        const process* proc = job->process_list[i];
+        fprintf(out, "%s{\"pid\":%ld,\"cmd\":", i ? "," : "", (long)proc->pid);
+        json_write_string(out, proc->name);
+        fprintf(out, ",\"status\":%d,\"real_s\":%.6f,", exit_code(proc->exit_status),
+                timespec_seconds_between(&proc->started, &proc->finished));
+        write_json_usage(out, &proc->usage);
+        fputc('}', out);
+    }
+    fputs("]}\n", out);
+    fclose(out);
+}
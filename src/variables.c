@@ -1,23 +1,144 @@
 #include "../headers/variables.h"
+#include "../headers/pathcache.h"
+#include "../headers/hash.h"
+#include "../headers/table.h"
 
-var_t* var_list = NULL;
+typedef struct {
+    uint64_t hash;
+    var_t* var;
+} var_slot;
 
-void set_var(const char *name, const char *value) {
-    var_t *curr = var_list;
-    while (curr) {
-        if (strcmp(curr->name, name) == 0) {
-            free(curr->value);
-            curr->value = strdup(value);
-            return;
+static hash_table table = TABLE_INIT(var_slot);
+
+// Exported entries, NULL-terminated. env_owner[i] is the var whose entry
+// sits in env_vec[i], so removals can swap the last slot in.
+static char** env_vec = NULL;
+static var_t** env_owner = NULL;
+static size_t env_count = 0;
+static size_t env_capacity = 0;
+
+static int var_named(const void* entry, const void* name) {
+    return strcmp(((const var_slot*)entry)->var->name, name) == 0;
+}
+
+static var_slot* find_slot(const char* name) {
+    return table_find(&table, fnv1a_str(FNV1A_SEED, name), var_named, name);
+}
+
+static var_t* find_var(const char* name) {
+    var_slot* slot = find_slot(name);
+    return slot ? slot->var : NULL;
+}
+
+static char* make_entry(const char* name, const char* value) {
+    size_t name_len = strlen(name), value_len = strlen(value);
+    char* entry = malloc(name_len + value_len + 2);
+    if (entry == NULL) {
+        perror("allocation failed");
+        return NULL;
+    }
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, value_len + 1);
+    return entry;
+}
+
+static int env_append(var_t* v) {
+    if (env_count + 1 >= env_capacity) {
+        size_t new_capacity = env_capacity ? env_capacity * 2 : 64;
+        char** new_vec = realloc(env_vec, new_capacity * sizeof(char*));
+        if (new_vec == NULL) {
+            perror("allocation failed");
+            return -1;
         }
-        curr = curr->next;
+        env_vec = new_vec;
+        var_t** new_owner = realloc(env_owner, new_capacity * sizeof(var_t*));
+        if (new_owner == NULL) {
+            perror("allocation failed");
+            return -1;
+        }
+        env_owner = new_owner;
+        env_capacity = new_capacity;
+    }
+    v->env_index = env_count;
+    env_vec[env_count] = v->entry;
+    env_owner[env_count] = v;
+    env_vec[++env_count] = NULL;
+    return 0;
+}
+
+static void env_remove(var_t* v) {
+    size_t last = --env_count;
+    if (v->env_index != last) {
+        env_vec[v->env_index] = env_vec[last];
+        env_owner[v->env_index] = env_owner[last];
+        env_owner[v->env_index]->env_index = v->env_index;
     }
-    // Not found → add new var
-    var_t *new_var = malloc(sizeof(var_t));
-    new_var->name = strdup(name);
-    new_var->value = strdup(value);
-    new_var->next = var_list;
-    var_list = new_var;
+    env_vec[last] = NULL;
+}
+
+// Hashed command locations are only valid for the PATH they were found in.
+// Every write goes through here, so for loops and $(( )) assignments too.
+static void invalidate_if_path(const char* name) {
+    if (strcmp(name, "PATH") == 0)
+        pathcache_clear();
+}
+
+static var_t* insert_var(const char* name, const char* value) {
+    var_t* v = malloc(sizeof(var_t));
+    if (v == NULL) {
+        perror("allocation failed");
+        return NULL;
+    }
+
+    var_slot* slot = table_insert(&table, fnv1a_str(FNV1A_SEED, name), var_named, name);
+    if (slot == NULL) {
+        free(v);
+        return NULL;
+    }
+    v->name = strdup(name);
+    v->value = strdup(value);
+    v->entry = NULL;
+    v->exported = 0;
+    v->env_index = 0;
+
+    slot->var = v;
+    return v;
+}
+
+void set_var(const char *name, const char *value) {
+    invalidate_if_path(name);
+    var_t* v = find_var(name);
+    if (v == NULL) {
+        insert_var(name, value);
+        return;
+    }
+
+    free(v->value);
+    v->value = strdup(value);
+    if (v->exported) {
+        char* entry = make_entry(name, value);
+        if (entry == NULL) return;
+        free(v->entry);
+        v->entry = entry;
+        env_vec[v->env_index] = entry;
+    }
+}
+
+int export_var(const char *name) {
+    var_t* v = find_var(name);
+    if (v == NULL) return -1;
+    if (v->exported) return 0;
+
+    v->entry = make_entry(v->name, v->value);
+    if (v->entry == NULL) return -1;
+    if (env_append(v) < 0) {
+        free(v->entry);
+        v->entry = NULL;
+        return -1;
+    }
+    v->exported = 1;
+    return 0;
 }
 
 void load_environment() {
@@ -28,49 +149,56 @@ void load_environment() {
 
         size_t name_len = eq - entry;
         char name[name_len + 1];
-        strncpy(name, entry, name_len);
+        memcpy(name, entry, name_len);
         name[name_len] = '\0';
 
-        const char *value = eq + 1;
-
-        set_var(name, value);
+        set_var(name, eq + 1);
+        export_var(name);
     }
 }
 
 char* get_var(const char *name) {
-    var_t *curr = var_list;
-    while (curr) {
-        if (strcmp(curr->name, name) == 0) {
-            return curr->value;
-        }
-        curr = curr->next;
-    }
-    return getenv(name); // fallback to environment
+    var_t* v = find_var(name);
+    return v ? v->value : NULL;
+}
+
+char** var_environ(void) {
+    static char* empty[] = {NULL};
+    return env_vec ? env_vec : empty;
+}
+
+static int compare_vars(const void* a, const void* b) {
+    return strcmp((*(var_t* const*)a)->name, (*(var_t* const*)b)->name);
 }
 
 void print_all_var() {
-    var_t* curr = var_list;
+    if (table.count == 0) return;
 
-    while (curr != NULL) {
-        printf("%s=%s\n", curr->name, curr->value);
-        curr = curr->next;
+    var_t** sorted = malloc(table.count * sizeof(var_t*));
+    if (sorted == NULL) {
+        perror("allocation failed");
+        return;
     }
+    size_t n = 0;
+    for (var_slot* slot = table_next(&table, NULL); slot; slot = table_next(&table, slot))
+        sorted[n++] = slot->var;
+    qsort(sorted, n, sizeof(var_t*), compare_vars);
+
+    for (size_t i = 0; i < n; ++i)
+        printf("%s=%s\n", sorted[i]->name, sorted[i]->value);
+    free(sorted);
 }
 
-void unset_var(char* name) {
-    var_t* curr = var_list, *prev = NULL;
+void unset_var(const char* name) {
+    invalidate_if_path(name);
+    var_slot* slot = find_slot(name);
+    if (slot == NULL) return;
 
-    while (curr) {
-        if (strcmp(curr->name, name) == 0) {
-            if (prev)
-                prev->next = curr->next;
-            else
-                var_list = curr->next;
-            
-            //free the mem
-            return;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-}
\ No newline at end of file
+    var_t* v = slot->var;
+    table_remove(&table, slot);
+    if (v->exported) env_remove(v);
+    free(v->entry);
+    free(v->name);
+    free(v->value);
+    free(v);
+}